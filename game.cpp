@@ -1,24 +1,16 @@
 #include <iostream>
 #include <SFML/Graphics.hpp>
 #include <cmath>
+#include <cstring>
 #include <sock/Poll.hpp>
 #include <tcp/TcpClient.hpp>
+#include <pong/Protocol.hpp>
+#include <pong/SnapshotBuffer.hpp>
+#include <pong/PadPredictor.hpp>
+#include <pong/Rollback.hpp>
+#include <optional>
 #include <netinet/tcp.h>
 
-enum MessageType : char {
-    MovePad, Tick, BallUpdate, PadUpdate, ScoreUpdate, PlayerAssignment, GameStart, GameEnd
-};
-
-struct __attribute__((packed)) MessageHeader {
-    MessageType type;
-    unsigned int length;
-};
-
-struct Message {
-    MessageHeader header{MovePad, 0};
-    std::string data;
-};
-
 Message fetchMessage(sock::Socket socket){
     Message message;
     socket.recv(&message.header, 5, MSG_WAITALL);
@@ -35,10 +27,6 @@ void writeMessage(sock::Socket socket, MessageType type, unsigned int length, co
     socket.send(data, length);
 }
 
-struct Position {
-    double x, y;
-};
-
 int main(int argc, char **argv) {
     tcp::TcpClient client;
     int t = 1;
@@ -61,10 +49,24 @@ int main(int argc, char **argv) {
 
     int player1Score;
     int player2Score;
+    int localPlayer = 1;
 
     sf::Vector2f ballPosition{400, 300};
 
     sf::Clock clock;
+    double inputTime = 0;
+
+    pong::SnapshotBuffer snapshots;
+    pong::Snapshot pendingSnapshot{0, {WIN_SIZEX / 2., WIN_SIZEY / 2.}, {WIN_SIZEY / 2., WIN_SIZEY / 2.}};
+    pong::PadPredictor predictor;
+    // Only set in rollback mode, the whole match then runs here instead of coming in as snapshots
+    std::optional<pong::RollbackSession> rollback;
+    double matchStart = 0;
+    int tickRate = TPS; // The match's, from GameStart
+    // Arena mode draws whatever the server lists, pads first and then balls
+    bool arena = false;
+    int arenaPads = 0;
+    std::vector<sf::Vector2f> arenaEntities;
 
     sf::RectangleShape ballShape({10, 10}), player1PadShape({10, 80}), player2PadShape({10, 80});
     ballShape.setOrigin(5, 5);
@@ -102,37 +104,102 @@ int main(int argc, char **argv) {
 
         movePad = -wPressed + sPressed;
 
-        if (pollList.poll(0) != 0){
-            if (pollList[client].canRead()){
-                Message message = fetchMessage(client);
-                if (message.header.type == BallUpdate){
-                    Position position = *(Position *)message.data.data();
-                    ballPosition.x = (float)position.x;
-                    ballPosition.y = (float)position.y;
-                }
-                if (message.header.type == PadUpdate){
-                    auto *pads = (double *)message.data.data();
-                    player1PadPosition = (float)pads[0];
-                    player2PadPosition = (float)pads[1];
-                }
-                if (message.header.type == ScoreUpdate){
-                    auto *scores = (int *)message.data.data();
-                    player1Score = scores[0];
-                    player2Score = scores[1];
-                    player1ScoreText.setString(std::to_string(player1Score));
-                    player2ScoreText.setString(std::to_string(player2Score));
-                }
-                if (message.header.type == Tick){
-                    if (movePad != 0) writeMessage(client, MovePad, sizeof(int), &movePad);
-                }
-                if (message.header.type == GameStart){
-                    gameStarted = true;
-                }
-                if (message.header.type == GameEnd){
-                    gameStarted = false;
-                }
+        double now = clock.getElapsedTime().asSeconds();
+        // One input per tick goes out for a delayed tick, the local match runs on our own clock as far as prediction allows
+        if (gameStarted && rollback){
+            auto target = (unsigned)((now - matchStart) * tickRate);
+            for (int steps = 0; steps < 8 && rollback->tick() < target && rollback->canAdvance(); steps++){
+                TickInput input = rollback->localInput(movePad);
+                writeMessage(client, InputFrame, sizeof(TickInput), &input);
+                rollback->advance();
+            }
+        }
+        // Inputs go out at the server's tick rate on our own clock, each one is applied locally right away
+        else if (gameStarted){
+            if (now - inputTime > 8. / tickRate) inputTime = now - 8. / tickRate;
+            while (inputTime + 1. / tickRate <= now){
+                inputTime += 1. / tickRate;
+                if (movePad == 0) continue;
+                PadInput input = predictor.input(movePad);
+                writeMessage(client, MovePad, sizeof(PadInput), &input);
             }
         }
+        else inputTime = now;
+
+        while (pollList.poll(0) != 0 && pollList[client].canRead()){
+            Message message = fetchMessage(client);
+            if (message.header.type == BallUpdate){
+                pendingSnapshot.ball = *(Position *)message.data.data();
+            }
+            if (message.header.type == PadUpdate){
+                auto *pads = (double *)message.data.data();
+                pendingSnapshot.pads[0] = pads[0];
+                pendingSnapshot.pads[1] = pads[1];
+            }
+            if (message.header.type == ScoreUpdate){
+                auto *scores = (int *)message.data.data();
+                player1Score = scores[0];
+                player2Score = scores[1];
+                player1ScoreText.setString(std::to_string(player1Score));
+                player2ScoreText.setString(std::to_string(player2Score));
+            }
+            if (message.header.type == Tick){
+                auto *info = (TickInfo *)message.data.data();
+                pendingSnapshot.tick = info->tick;
+                snapshots.push(pendingSnapshot, clock.getElapsedTime().asSeconds());
+                predictor.reconcile(pendingSnapshot.pads[localPlayer - 1], info->lastInput);
+            }
+            if (message.header.type == PlayerAssignment){
+                localPlayer = *(int *)message.data.data();
+            }
+            if (message.header.type == GameStart){
+                gameStarted = true;
+                pendingSnapshot.ball = {WIN_SIZEX / 2., WIN_SIZEY / 2.};
+                GameSettings settings{ServerAuthoritative, 0, TPS};
+                std::memcpy(&settings, message.data.data(), std::min(message.data.size(), sizeof(GameSettings)));
+                tickRate = settings.tickRate != 0 ? settings.tickRate : TPS;
+                snapshots.clear(tickRate);
+                predictor.reset(WIN_SIZEY / 2., tickRate);
+                if (settings.mode == Rollback) rollback.emplace(localPlayer, settings.inputDelay, tickRate);
+                else rollback.reset();
+                arena = settings.mode == Arena;
+                matchStart = clock.getElapsedTime().asSeconds();
+            }
+            if (message.header.type == ArenaLayout && message.data.size() >= sizeof(ArenaInfo)){
+                auto *info = (ArenaInfo *)message.data.data();
+                auto *padX = (float *)(message.data.data() + sizeof(ArenaInfo));
+                arenaPads = info->pads;
+                arenaEntities.assign(info->pads + info->balls, {WIN_SIZEX / 2.f, WIN_SIZEY / 2.f});
+                for (int pad = 0; pad < arenaPads && sizeof(ArenaInfo) + (pad + 1) * sizeof(float) <= message.data.size(); pad++)
+                    arenaEntities[pad].x = padX[pad];
+            }
+            if (message.header.type == ArenaUpdate){
+                auto *updates = (EntityUpdate *)message.data.data();
+                for (size_t i = 0; i < message.data.size() / sizeof(EntityUpdate); i++)
+                    if (updates[i].id < arenaEntities.size()) arenaEntities[updates[i].id] = {updates[i].x, updates[i].y};
+            }
+            if (message.header.type == InputFrame && rollback){
+                rollback->remoteInput(*(TickInput *)message.data.data());
+            }
+            if (message.header.type == GameEnd){
+                gameStarted = false;
+                rollback.reset();
+                arena = false;
+            }
+        }
+
+        pong::Snapshot shown = pendingSnapshot;
+        snapshots.sample(clock.getElapsedTime().asSeconds(), shown);
+        shown.pads[localPlayer - 1] = predictor.position();
+        if (rollback){
+            shown.ball = pong::RollbackSimulation::ball(rollback->state());
+            shown.pads[0] = pong::RollbackSimulation::pad(rollback->state(), 0);
+            shown.pads[1] = pong::RollbackSimulation::pad(rollback->state(), 1);
+        }
+        ballPosition.x = (float)shown.ball.x;
+        ballPosition.y = (float)shown.ball.y;
+        player1PadPosition = (float)shown.pads[0];
+        player2PadPosition = (float)shown.pads[1];
 
         ballShape.setPosition(ballPosition);
 
@@ -140,7 +207,17 @@ int main(int argc, char **argv) {
         player2PadShape.setPosition(780, player2PadPosition);
 
         window.clear();
-        if (gameStarted) {
+        if (gameStarted && arena) {
+            for (int id = 0; id < (int)arenaEntities.size(); id++) {
+                sf::RectangleShape &shape = id < arenaPads ? player1PadShape : ballShape;
+                shape.setFillColor(id == localPlayer - 1 ? sf::Color::Yellow : sf::Color::White);
+                shape.setPosition(arenaEntities[id]);
+                window.draw(shape);
+            }
+            player1PadShape.setFillColor(sf::Color::White);
+            window.draw(player1ScoreText);
+            window.draw(player2ScoreText);
+        }else if (gameStarted) {
             window.draw(player1PadShape);
             window.draw(player2PadShape);
             window.draw(player1ScoreText);
@@ -0,0 +1,458 @@
+#ifndef MULTIPONG_SELFCHECK_HPP
+#define MULTIPONG_SELFCHECK_HPP
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include "../coro/AsyncSocket.hpp"
+#include "../pong/Rollback.hpp"
+#include "../pong/SnapshotBuffer.hpp"
+#include "../rt/TickPipeline.hpp"
+#include "../rt/TimerWheel.hpp"
+#include "../tcp/SnapshotPacer.hpp"
+
+// Deterministic checks of the parts that don't need a network or a window, run with Server --self-check <name> and
+// registered with ctest. Each prints one line and returns false when something is off.
+namespace check {
+    // Directions that change often enough for a guess of "same as last tick" to be wrong now and then
+    inline int scriptedDirection(int player, unsigned tick){
+        unsigned x = (tick / (5 + 4 * player) + 17 * player) * 2654435761u;
+        return (int)(x >> 28) % 3 - 1;
+    }
+
+    inline bool sameMatch(const pong::RollbackSimulation::State &a, const pong::RollbackSimulation::State &b){
+        return a.ballX == b.ballX && a.ballY == b.ballY && a.ballDirection == b.ballDirection && a.ballSpeed == b.ballSpeed &&
+               a.pads[0] == b.pads[0] && a.pads[1] == b.pads[1] && a.scores[0] == b.scores[0] && a.scores[1] == b.scores[1];
+    }
+
+    // Snapshots arriving exactly on time, at the default rate and at half of it: rendering three ticks behind lands
+    // halfway between two snapshots, a serve isn't interpolated across the field and running out holds the newest one
+    inline bool snapshotBuffer(){
+        constexpr double latency = .05;
+        constexpr unsigned count = 20, serve = 10;
+        auto ballX = [](unsigned tick){
+            return tick < serve ? 100. + 2 * tick : WIN_SIZEX / 2. + 2 * (tick - serve);
+        };
+        for (int tickRate : {TPS, TPS / 2}) {
+            pong::SnapshotBuffer buffer;
+            buffer.clear(tickRate);
+            for (unsigned tick = 0; tick < count; tick++)
+                buffer.push({tick, {ballX(tick), 300}, {200. + tick, 400. - tick}}, latency + tick / (double)tickRate);
+            auto at = [&](double renderTick){
+                pong::Snapshot shown{};
+                buffer.sample(latency + (renderTick + 3) / tickRate, shown);
+                return shown;
+            };
+            std::string error;
+            pong::Snapshot between = at(4.5), acrossServe = at(serve - .75), past = at(count + 5);
+            if (std::abs(between.ball.x - (ballX(4) + ballX(5)) / 2) > 1e-9 || std::abs(between.pads[0] - 204.5) > 1e-9 || std::abs(between.pads[1] - 395.5) > 1e-9)
+                error = "a sample halfway between two snapshots isn't halfway";
+            else if (acrossServe.ball.x != ballX(serve - 1))
+                error = "the ball was interpolated across a serve";
+            else if (past.tick != count - 1 || past.ball.x != ballX(count - 1))
+                error = "running out of snapshots didn't hold the newest one";
+            if (!error.empty()) {
+                std::cout << "Snapshot buffer check at " << tickRate << " tps: " << error << std::endl;
+                return false;
+            }
+        }
+        std::cout << "Snapshot buffer interpolates, holds serves and the newest snapshot at " << TPS << " and " << TPS / 2 << " tps" << std::endl;
+        return true;
+    }
+
+    // Two clients that only hear from each other every few ticks have to mispredict, roll back and still land on
+    // the bits of the server's arbiter, which only ever ran confirmed inputs
+    inline bool rollback(){
+        constexpr unsigned ticks = 5000, delay = 2, latency = 9;
+        pong::RollbackSession sessions[2]{{1, delay}, {2, delay}};
+        pong::RollbackArbiter arbiter(delay);
+        std::vector<TickInput> inFlight[2];
+        auto deliver = [&]{
+            for (int player = 0; player < 2; player++) {
+                for (const TickInput &input : inFlight[player]) {
+                    if (!sessions[1 - player].remoteInput(input)) {
+                        std::cout << "Rollback check: input for tick " << input.tick << " refused" << std::endl;
+                        return false;
+                    }
+                }
+                inFlight[player].clear();
+            }
+            return true;
+        };
+        for (unsigned tick = 0; tick < ticks; tick++) {
+            for (int player = 0; player < 2; player++) {
+                TickInput input = sessions[player].localInput(scriptedDirection(player, tick));
+                inFlight[player].push_back(input);
+                if (!arbiter.input(player, input)) {
+                    std::cout << "Rollback check: the arbiter refused tick " << input.tick << std::endl;
+                    return false;
+                }
+            }
+            while (arbiter.ready()) arbiter.step();
+            if (tick % latency == latency - 1 && !deliver()) return false;
+            for (pong::RollbackSession &session : sessions) session.advance();
+        }
+        if (!deliver()) return false;
+        // Inputs are known up to the arbiter's tick now, the sessions replay whatever they guessed wrong on the way there
+        for (pong::RollbackSession &session : sessions)
+            while (session.tick() < arbiter.tick()) session.advance();
+        for (int player = 0; player < 2; player++) {
+            if (sessions[player].rollbacks() == 0) {
+                std::cout << "Rollback check: player " << player + 1 << " never rolled back, nothing was tested" << std::endl;
+                return false;
+            }
+            if (!sameMatch(sessions[player].state(), arbiter.state())) {
+                std::cout << "Rollback check: player " << player + 1 << " ended on a different state than the arbiter at tick " << arbiter.tick() << std::endl;
+                return false;
+            }
+        }
+        std::cout << "Rollback sessions match the arbiter after " << arbiter.tick() << " ticks (" << sessions[0].rollbacks() + sessions[1].rollbacks()
+                  << " rollbacks, score " << arbiter.state().scores[0] << " - " << arbiter.state().scores[1] << ")" << std::endl;
+        return true;
+    }
+
+    // Reads frames until the socket fails, spawned tasks have to keep their exceptions to themselves
+    inline coro::Task<void> collectFrames(coro::AsyncSocket &socket, std::vector<Message> &frames, std::exception_ptr &failure){
+        try {
+            while (true) frames.push_back(co_await socket.recvFrame());
+        } catch (...) {
+            failure = std::current_exception();
+        }
+    }
+
+    inline coro::Task<void> sendAll(coro::AsyncSocket &socket, const std::vector<char> &data, bool &done){
+        co_await socket.send(data);
+        done = true;
+    }
+
+    inline std::vector<char> frame(MessageType type, unsigned int length, const std::string &data){
+        MessageHeader header{type, length};
+        std::vector<char> bytes((const char *)&header, (const char *)&header + sizeof(header));
+        bytes.insert(bytes.end(), data.begin(), data.end());
+        return bytes;
+    }
+
+    // The coroutine socket over a socketpair, driven one runOnce at a time so every step is the same on every run:
+    // frames split anywhere come out whole, an oversized header fails the reader, cancel() wakes a waiting reader
+    // with Cancelled and a send bigger than the socket buffer suspends until the peer drained it
+    inline bool coroutines(){
+        int pair[2], other[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) == -1 || socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, other) == -1) {
+            std::cout << "Coroutine check: socketpair failed (" << std::strerror(errno) << ")" << std::endl;
+            return false;
+        }
+        auto fail = [&](const std::string &what){
+            std::cout << "Coroutine check: " << what << std::endl;
+            for (int fd : {pair[0], pair[1], other[0], other[1]}) ::close(fd);
+            return false;
+        };
+        coro::EventLoop loop;
+        coro::AsyncSocket reader(loop, sock::Socket(pair[0])), writer(loop, sock::Socket(pair[1]));
+        std::vector<Message> frames;
+        std::exception_ptr failure;
+        coro::spawn(collectFrames(reader, frames, failure));
+        std::vector<char> first = frame(ScoreUpdate, 8, "abcdefgh");
+        for (size_t i = 0; i < first.size(); i++) {
+            if (!frames.empty()) return fail("a frame came out before all of it arrived");
+            ::send(pair[1], &first[i], 1, 0);
+            loop.runOnce(0);
+        }
+        if (frames.size() != 1 || frames[0].header.type != ScoreUpdate || frames[0].data != "abcdefgh") return fail("a frame sent a byte at a time came out wrong");
+        // Two frames and the header of a third in one go, the rest of the third later
+        std::vector<char> burst = frame(PadUpdate, 3, "xyz");
+        std::vector<char> second = frame(Tick, 0, ""), third = frame(GameEnd, 4, "1234");
+        burst.insert(burst.end(), second.begin(), second.end());
+        burst.insert(burst.end(), third.begin(), third.begin() + 7);
+        ::send(pair[1], burst.data(), burst.size(), 0);
+        loop.runOnce(0);
+        if (frames.size() != 3 || frames[1].data != "xyz" || frames[2].header.type != Tick || !frames[2].data.empty()) return fail("two frames in one read came out wrong");
+        ::send(pair[1], third.data() + 7, third.size() - 7, 0);
+        loop.runOnce(0);
+        if (frames.size() != 4 || frames[3].data != "1234") return fail("the rest of a split frame didn't complete it");
+        std::vector<char> huge = frame(MovePad, coro::AsyncSocket::maxFrame + 1, "");
+        ::send(pair[1], huge.data(), huge.size(), 0);
+        loop.runOnce(0);
+        try {
+            if (failure) std::rethrow_exception(failure);
+            return fail("an oversized frame was accepted");
+        } catch (sock::ReadException &) {
+        } catch (...) {
+            return fail("an oversized frame failed the reader with the wrong exception");
+        }
+        // A reader waiting on nothing gets Cancelled on the next run after cancel()
+        coro::AsyncSocket idle(loop, sock::Socket(other[0]));
+        std::vector<Message> idleFrames;
+        std::exception_ptr idleFailure;
+        coro::spawn(collectFrames(idle, idleFrames, idleFailure));
+        loop.cancel(other[0]);
+        loop.runOnce(0);
+        try {
+            if (idleFailure) std::rethrow_exception(idleFailure);
+            return fail("cancel() didn't wake the waiting reader");
+        } catch (coro::Cancelled &) {
+        } catch (...) {
+            return fail("cancel() woke the reader with the wrong exception");
+        }
+        // Far more than a socket buffer, the send has to suspend until the other end reads
+        std::vector<char> payload(1 << 20);
+        for (size_t i = 0; i < payload.size(); i++) payload[i] = (char)(i * 31 + i / 977);
+        bool sent = false;
+        coro::spawn(sendAll(writer, payload, sent));
+        if (sent) return fail("a 1 MiB send finished without ever waiting");
+        std::vector<char> received;
+        char buffer[65536];
+        for (int runs = 0; received.size() < payload.size() && runs < 100000; runs++) {
+            ssize_t read = ::recv(pair[0], buffer, sizeof(buffer), MSG_DONTWAIT);
+            if (read > 0) received.insert(received.end(), buffer, buffer + read);
+            loop.runOnce(0);
+        }
+        if (!sent || received != payload) return fail("a suspended send didn't deliver every byte in order");
+        for (int fd : {pair[0], pair[1], other[0], other[1]}) ::close(fd);
+        std::cout << "Coroutine sockets reassemble split frames, reject oversized ones, cancel and resume suspended sends" << std::endl;
+        return true;
+    }
+
+    // Every snapshot reaches the stage once and in order, on its own thread when threaded, and a stage that throws
+    // hands the exception to the tick thread without taking the pipeline down
+    inline bool pipelineRun(bool threaded){
+        constexpr unsigned count = 2000, failing = 1500;
+        const char *mode = threaded ? "threaded" : "inline";
+        std::vector<unsigned> seen;
+        bool wrongThread = false;
+        std::thread::id tickThread = std::this_thread::get_id();
+        rt::TickPipeline<unsigned> pipeline([&](const unsigned &snapshot){
+            if ((std::this_thread::get_id() != tickThread) != threaded) wrongThread = true;
+            if (snapshot == failing) throw std::runtime_error("scripted failure");
+            seen.push_back(snapshot);
+        }, threaded);
+        bool thrown = false;
+        for (unsigned snapshot = 1; snapshot <= count; snapshot++) {
+            try {
+                pipeline.startTick();
+                pipeline.publish(snapshot);
+                // Threaded, the failure comes out of whatever follows it
+                if (snapshot == failing) pipeline.drain();
+            } catch (std::runtime_error &) {
+                if (snapshot != failing) {
+                    std::cout << "Pipeline check (" << mode << "): the failure came out at snapshot " << snapshot << std::endl;
+                    return false;
+                }
+                thrown = true;
+            }
+        }
+        pipeline.drain();
+        rt::StageTimes times = pipeline.takeTimes();
+        bool inOrder = seen.size() == count - 1;
+        for (size_t i = 0; inOrder && i < seen.size(); i++) inOrder = seen[i] == i + 1 + (i + 1 >= failing);
+        if (!thrown || !inOrder || wrongThread || times.ticks != count || pipeline.threaded() != threaded) {
+            std::cout << "Pipeline check (" << mode << "): " << (!thrown ? "the stage's failure never reached the tick thread" : !inOrder ? "snapshots were lost, repeated or reordered" :
+                                                                 wrongThread ? "the stage ran on the wrong thread" : "the tick count is off") << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    inline bool pipeline(){
+        if (!pipelineRun(true) || !pipelineRun(false)) return false;
+        std::cout << "Tick pipeline delivers every snapshot in order and reports stage failures, threaded and inline" << std::endl;
+        return true;
+    }
+
+    // Timers on every level of the wheel and past its range, periodic ones, moved ones and cancelled ones, advanced by
+    // a scripted clock in uneven steps and straight to nextDeadline(). Each one has to fire in the first advance that
+    // covers its deadline rounded up to the resolution, never earlier, and in deadline order within an advance.
+    inline bool timerWheel(){
+        using std::chrono::nanoseconds;
+        using Clock = std::chrono::steady_clock;
+        constexpr nanoseconds resolution{25000};
+        constexpr int count = 400;
+        constexpr unsigned periodicFires = 20;
+        const Clock::time_point start{};
+        uint64_t seed = 42;
+        auto random = [&seed](uint64_t bound){
+            seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+            return (seed >> 33) % bound;
+        };
+        auto expiry = [&](Clock::time_point deadline){
+            return deadline <= start ? 0 : (uint64_t)((deadline - start + resolution - nanoseconds(1)) / resolution);
+        };
+        auto tick = [&](Clock::time_point time){
+            return (uint64_t)((time - start) / resolution);
+        };
+        Clock::time_point now = start, previous = start;
+        // A deadline the wheel already passed fires on its next tick
+        auto due = [&](Clock::time_point deadline){
+            return std::max(expiry(deadline), tick(now) + 1);
+        };
+        struct Entry {
+            std::unique_ptr<rt::Timer> timer;
+            uint64_t due = 0; // Wheel tick it has to fire on
+            bool pending = true, cancelled = false;
+            unsigned fired = 0;
+            nanoseconds period{0}; // Periodic ones schedule themselves again
+        };
+        rt::TimerWheel wheel(resolution, start);
+        std::vector<Entry> entries(count);
+        uint64_t lastDue = 0;
+        std::string error;
+        // Spans that land on each of the four levels, and a few past the wheel's range
+        const uint64_t spans[]{rt::TimerWheel::slots, (uint64_t)1 << 12, (uint64_t)1 << 18, rt::TimerWheel::range, rt::TimerWheel::range * 2};
+        for (int i = 0; i < count; i++) {
+            Entry &entry = entries[i];
+            if (i % 10 == 0) entry.period = resolution * (1 + (Clock::rep)random(200)) + nanoseconds(random(25000));
+            Clock::time_point deadline = start + resolution * (Clock::rep)random(spans[i % 5]) + nanoseconds(1 + random(25000));
+            entry.timer = std::make_unique<rt::Timer>([&, i]{
+                Entry &fired = entries[i];
+                if (error.empty()) {
+                    if (!fired.pending) error = "timer " + std::to_string(i) + " fired without being scheduled";
+                    else if (tick(now) < fired.due) error = "timer " + std::to_string(i) + " fired early";
+                    else if (tick(previous) >= fired.due) error = "timer " + std::to_string(i) + " fired an advance late";
+                    else if (fired.due < lastDue) error = "timer " + std::to_string(i) + " fired out of order";
+                }
+                lastDue = fired.due;
+                fired.pending = false;
+                fired.fired++;
+                if (fired.period.count() != 0 && fired.fired < periodicFires) {
+                    fired.due = due(now + fired.period);
+                    fired.pending = true;
+                    wheel.schedule(*fired.timer, now + fired.period);
+                }
+            });
+            entry.due = due(deadline);
+            wheel.schedule(*entry.timer, deadline);
+        }
+        for (unsigned advances = 0; wheel.size() != 0 && error.empty(); advances++) {
+            if (advances == 1000000) {
+                error = "timers still pending after a million advances";
+                break;
+            }
+            Clock::time_point earliest = Clock::time_point::max();
+            for (const Entry &entry : entries)
+                if (entry.pending) earliest = std::min(earliest, start + resolution * (Clock::rep)entry.due);
+            auto next = wheel.nextDeadline();
+            if (!next || *next > earliest) {
+                error = "nextDeadline() is past the earliest pending timer";
+                break;
+            }
+            if (advances == 3 || advances == 5) {
+                for (int i = 0; i < count; i++) {
+                    Entry &entry = entries[i];
+                    if (!entry.pending || entry.period.count() != 0) continue;
+                    if (advances == 3 && i % 11 == 5) {
+                        Clock::time_point deadline = now + resolution * (Clock::rep)random(1 << 14) + nanoseconds(random(25000));
+                        entry.due = due(deadline);
+                        wheel.schedule(*entry.timer, deadline);
+                    }
+                    if (advances == 5 && i % 7 == 3) {
+                        wheel.cancel(*entry.timer);
+                        entry.pending = false;
+                        entry.cancelled = true;
+                    }
+                }
+            }
+            previous = now;
+            now = advances % 2 == 0 ? *next : now + resolution * (Clock::rep)(1 + random(3000)) + nanoseconds(random(25000));
+            lastDue = 0;
+            wheel.advance(now);
+        }
+        for (int i = 0; i < count && error.empty(); i++) {
+            const Entry &entry = entries[i];
+            unsigned expected = entry.cancelled ? 0 : entry.period.count() != 0 ? periodicFires : 1;
+            if (entry.fired != expected) error = "timer " + std::to_string(i) + " fired " + std::to_string(entry.fired) + " times instead of " + std::to_string(expected);
+        }
+        if (error.empty() && wheel.nextDeadline()) error = "an empty wheel still reports a deadline";
+        if (!error.empty()) {
+            std::cout << "Timer wheel check: " << error << std::endl;
+            return false;
+        }
+        std::cout << "Timer wheel fired " << count << " timers on every level on time and in order, up to " << std::chrono::duration_cast<std::chrono::seconds>(now - start).count() << "s out" << std::endl;
+        return true;
+    }
+
+    // SnapshotPacer::update fed from a modelled link instead of a socket: the bottleneck drains rate bytes a second,
+    // everything past one bandwidth-delay product waits unsent and the RTT grows with what is queued. The link is fast,
+    // then far too slow for a snapshot every tick, then fast again.
+    inline bool snapshotPacer(){
+        using Clock = std::chrono::steady_clock;
+        constexpr double snapshotSize = 120, baseRtt = .02;
+        struct Phase {
+            double seconds, rate;
+        };
+        const Phase phases[]{{2, 200000}, {4, 4000}, {5, 200000}};
+        tcp::SnapshotPacer pacer;
+        tcp::LinkSample link;
+        double outq = 0;
+        unsigned skipped = 0, maxInterval[3]{}, endInterval[3]{};
+        double settledDelay[3]{}, recovered = -1;
+        unsigned long long tick = 0;
+        for (int phase = 0; phase < 3; phase++) {
+            double rate = phases[phase].rate;
+            for (unsigned i = 0; i < phases[phase].seconds * TPS; i++, tick++) {
+                auto now = Clock::time_point{} + std::chrono::nanoseconds(tick * 1000000000ull / TPS);
+                outq -= std::min(outq, rate / TPS);
+                if (++skipped >= pacer.interval()) {
+                    skipped = 0;
+                    link.outq = (size_t)outq;
+                    link.unsent = (size_t)std::max(outq - rate * baseRtt, 0.);
+                    link.rtt = std::chrono::microseconds((long long)((baseRtt + outq / rate) * 1e6));
+                    pacer.update(link, now);
+                    outq += snapshotSize;
+                    link.sent += (unsigned long long)snapshotSize;
+                }
+                maxInterval[phase] = std::max(maxInterval[phase], pacer.interval());
+                // How long a snapshot written now waits in the queue, once the pacer had a second to adapt
+                if (i >= TPS) settledDelay[phase] = std::max(settledDelay[phase], outq / rate);
+                if (phase == 2 && recovered < 0 && pacer.interval() == 1) recovered = (double)i / TPS;
+            }
+            endInterval[phase] = pacer.interval();
+        }
+        // The slow link takes a snapshot every 4.3 ticks at best
+        std::string error;
+        if (maxInterval[0] != 1) error = "snapshots were skipped on a link with room to spare";
+        else if (endInterval[1] < 4) error = "the interval stayed at " + std::to_string(endInterval[1]) + " on a link that can't take more than every 4th snapshot";
+        else if (settledDelay[1] > 2 * std::chrono::duration<double>(tcp::SnapshotPacer::highWater).count()) error = "snapshots queued for " + std::to_string((int)(settledDelay[1] * 1000)) + "ms on the slow link";
+        else if (endInterval[2] != 1 || recovered > 4) error = "the interval didn't get back to 1 within 4s once the link was fast again";
+        if (!error.empty()) {
+            std::cout << "Snapshot pacer check: " << error << std::endl;
+            return false;
+        }
+        std::cout << "Snapshot pacer backed off to every " << endInterval[1] << " ticks on the slow link with at most " << (int)(settledDelay[1] * 1000)
+                  << "ms queued, and was back to every tick " << recovered << "s after it recovered" << std::endl;
+        return true;
+    }
+
+    struct Check {
+        const char *name;
+        bool (*run)();
+    };
+
+    inline constexpr Check checks[]{
+        {"snapshot-buffer", snapshotBuffer},
+        {"rollback", rollback},
+        {"coroutines", coroutines},
+        {"pipeline", pipeline},
+        {"timer-wheel", timerWheel},
+        {"snapshot-pacer", snapshotPacer},
+    };
+
+    // Exit code for main, an unknown name lists the known ones
+    inline int run(const std::string &name){
+        for (const Check &check : checks)
+            if (name == check.name) return check.run() ? 0 : 1;
+        std::cout << "Unknown check " << name << ", known ones:";
+        for (const Check &check : checks) std::cout << " " << check.name;
+        std::cout << std::endl;
+        return 1;
+    }
+}
+
+#endif //MULTIPONG_SELFCHECK_HPP
@@ -0,0 +1,107 @@
+#ifndef MULTIPONG_ASYNCSOCKET_HPP
+#define MULTIPONG_ASYNCSOCKET_HPP
+
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include "EventLoop.hpp"
+#include "Task.hpp"
+#include "../sock/Socket.hpp"
+#include "../pong/Protocol.hpp"
+
+namespace coro {
+    // A sock::Socket driven by an EventLoop. Every operation tries the socket first and only suspends when it would
+    // block. Like sock::Socket it never closes the fd by itself.
+    class AsyncSocket {
+    public:
+        static constexpr unsigned int maxFrame = 1 << 16;
+
+        AsyncSocket(EventLoop &loop, sock::Socket socket) : m_loop(loop), m_socket(socket){
+
+        }
+
+        // For listening sockets, which get switched to non-blocking so a connection that vanished before accept can't
+        // stall the loop
+        Task<sock::Socket> accept(){
+            int flags = fcntl(m_socket.fd(), F_GETFL);
+            if (!(flags & O_NONBLOCK)) fcntl(m_socket.fd(), F_SETFL, flags | O_NONBLOCK);
+            while (true) {
+                int fd = ::accept4(m_socket.fd(), nullptr, nullptr, SOCK_CLOEXEC);
+                if (fd != -1) co_return sock::Socket(fd);
+                if (errno == EAGAIN || errno == EWOULDBLOCK) co_await m_loop.readable(m_socket.fd());
+                else if (errno != ECONNABORTED && errno != EINTR) throw sock::AcceptException("accept", m_socket.fd(), errno);
+            }
+        }
+
+        // The next whole message, whatever was read past it stays buffered for the next call
+        Task<Message> recvFrame(){
+            while (true) {
+                if (m_buffer.size() >= sizeof(MessageHeader)) {
+                    Message message;
+                    std::memcpy(&message.header, m_buffer.data(), sizeof(MessageHeader));
+                    if (message.header.length > maxFrame) throw sock::ReadException("frame too large", m_socket.fd());
+                    size_t size = sizeof(MessageHeader) + message.header.length;
+                    if (m_buffer.size() >= size) {
+                        message.data.assign(m_buffer.data() + sizeof(MessageHeader), message.header.length);
+                        m_buffer.erase(m_buffer.begin(), m_buffer.begin() + (long)size);
+                        co_return message;
+                    }
+                }
+                co_await fill();
+            }
+        }
+
+        Task<void> send(const void *data, size_t len){
+            const char *bytes = (const char *)data;
+            while (len != 0) {
+                iovec iov{(void *)bytes, len};
+                sock::Socket::len_t sent = m_socket.trySend(&iov, 1, MSG_NOSIGNAL);
+                if (sent == 0) {
+                    co_await m_loop.writable(m_socket.fd());
+                    continue;
+                }
+                bytes += sent;
+                len -= sent;
+            }
+        }
+
+        // The buffer has to outlive the send, which it does when awaited right away
+        Task<void> send(const std::vector<char> &buffer){
+            return send(buffer.data(), buffer.size());
+        }
+
+        // Bytes read past the last whole frame, someone taking over the socket has to start from these
+        [[nodiscard]] std::vector<char> &buffered(){
+            return m_buffer;
+        }
+
+        [[nodiscard]] const sock::Socket &socket() const{
+            return m_socket;
+        }
+    private:
+        // Reads straight into the buffer so a waiting coroutine doesn't carry a read buffer in its frame
+        Task<void> fill(){
+            constexpr size_t chunk = 512;
+            while (true) {
+                size_t used = m_buffer.size();
+                m_buffer.resize(used + chunk);
+                sock::Socket::len_t read;
+                try {
+                    read = m_socket.tryRecv(m_buffer.data() + used, chunk);
+                } catch (...) {
+                    m_buffer.resize(used);
+                    throw;
+                }
+                m_buffer.resize(used + read);
+                if (read != 0) co_return;
+                co_await m_loop.readable(m_socket.fd());
+            }
+        }
+
+        EventLoop &m_loop;
+        sock::Socket m_socket;
+        std::vector<char> m_buffer;
+    };
+}
+
+#endif //MULTIPONG_ASYNCSOCKET_HPP
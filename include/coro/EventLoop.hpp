@@ -0,0 +1,195 @@
+#ifndef MULTIPONG_EVENTLOOP_HPP
+#define MULTIPONG_EVENTLOOP_HPP
+
+#include <cerrno>
+#include <coroutine>
+#include <unordered_map>
+#include <vector>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+namespace coro {
+    class EventLoopException : public std::exception {
+    public:
+        EventLoopException(const char *what, int error) : m_what(what), m_error(error){
+
+        }
+
+        [[nodiscard]] const char *what() const noexcept override{
+            return m_what;
+        }
+
+        [[nodiscard]] int error() const noexcept{
+            return m_error;
+        }
+    private:
+        const char *m_what;
+        int m_error;
+    };
+
+    // Thrown out of a wait that was cancelled, the fd belongs to someone else now
+    class Cancelled : public std::exception {
+    public:
+        [[nodiscard]] const char *what() const noexcept override{
+            return "cancelled";
+        }
+    };
+
+    // Single threaded executor for coroutines waiting on fds. An fd is only registered with epoll while a coroutine
+    // waits on it, so a suspended coroutine costs its frame and one epoll entry and nothing is scanned per call.
+    class EventLoop {
+    public:
+        class Wait {
+        public:
+            Wait(EventLoop &loop, int fd, bool write) : m_loop(loop), m_fd(fd), m_write(write){
+
+            }
+
+            bool await_ready() const noexcept{
+                return false;
+            }
+
+            void await_suspend(std::coroutine_handle<> handle){
+                m_loop.wait(m_fd, m_write, handle, &m_cancelled);
+            }
+
+            void await_resume() const{
+                if (m_cancelled) throw Cancelled();
+            }
+        private:
+            EventLoop &m_loop;
+            int m_fd;
+            bool m_write;
+            bool m_cancelled = false;
+        };
+
+        class NextRun {
+        public:
+            explicit NextRun(EventLoop &loop) : m_loop(loop){
+
+            }
+
+            bool await_ready() const noexcept{
+                return false;
+            }
+
+            void await_suspend(std::coroutine_handle<> handle){
+                m_loop.m_ready.push_back(handle);
+            }
+
+            void await_resume() const noexcept{
+
+            }
+        private:
+            EventLoop &m_loop;
+        };
+
+        EventLoop() : m_epoll(epoll_create1(EPOLL_CLOEXEC)){
+            if (m_epoll == -1) throw EventLoopException("epoll_create1", errno);
+        }
+
+        EventLoop(const EventLoop &) = delete;
+        EventLoop &operator=(const EventLoop &) = delete;
+
+        ~EventLoop(){
+            ::close(m_epoll);
+        }
+
+        // Also wakes up on errors and hang ups, the operation that follows is what reports them
+        Wait readable(int fd){
+            return {*this, fd, false};
+        }
+
+        Wait writable(int fd){
+            return {*this, fd, true};
+        }
+
+        // Resumes on the next runOnce, for something worth retrying later but not right away
+        NextRun nextRun(){
+            return NextRun(*this);
+        }
+
+        // Wakes whatever waits on fd with Cancelled, on the next run
+        void cancel(int fd){
+            auto it = m_watches.find(fd);
+            if (it == m_watches.end()) return;
+            for (Waiter *waiter : {&it->second.reader, &it->second.writer}) {
+                if (!waiter->handle) continue;
+                *waiter->cancelled = true;
+                m_ready.push_back(waiter->handle);
+            }
+            epoll_ctl(m_epoll, EPOLL_CTL_DEL, fd, nullptr);
+            m_watches.erase(it);
+        }
+
+        // Resumes everything that is ready, waiting at most timeout ms for something to be. Returns how many
+        // coroutines ran.
+        size_t runOnce(int timeout = 0){
+            epoll_event events[64];
+            int count = epoll_wait(m_epoll, events, 64, m_ready.empty() ? timeout : 0);
+            if (count == -1 && errno != EINTR) throw EventLoopException("epoll_wait", errno);
+            for (int i = 0; i < count; i++) wake(events[i].data.fd, events[i].events);
+            std::vector<std::coroutine_handle<>> ready;
+            ready.swap(m_ready);
+            for (std::coroutine_handle<> handle : ready) handle.resume();
+            return ready.size();
+        }
+
+        [[nodiscard]] size_t waiting() const{
+            return m_watches.size();
+        }
+    private:
+        struct Waiter {
+            std::coroutine_handle<> handle;
+            bool *cancelled = nullptr;
+        };
+
+        struct Watch {
+            Waiter reader, writer;
+        };
+
+        static unsigned interest(const Watch &watch){
+            return (watch.reader.handle ? unsigned(EPOLLIN | EPOLLRDHUP) : 0u) | (watch.writer.handle ? unsigned(EPOLLOUT) : 0u);
+        }
+
+        void wait(int fd, bool write, std::coroutine_handle<> handle, bool *cancelled){
+            auto [it, added] = m_watches.try_emplace(fd);
+            (write ? it->second.writer : it->second.reader) = {handle, cancelled};
+            epoll_event event{interest(it->second), {.fd = fd}};
+            if (epoll_ctl(m_epoll, added ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &event) == -1) {
+                int error = errno;
+                if (added) m_watches.erase(it);
+                else (write ? it->second.writer : it->second.reader) = {};
+                throw EventLoopException("epoll_ctl", error);
+            }
+        }
+
+        void wake(int fd, unsigned events){
+            auto it = m_watches.find(fd);
+            if (it == m_watches.end()) return;
+            Watch &watch = it->second;
+            bool failed = events & (EPOLLERR | EPOLLHUP);
+            if (watch.reader.handle && (failed || events & (EPOLLIN | EPOLLRDHUP))) {
+                m_ready.push_back(watch.reader.handle);
+                watch.reader = {};
+            }
+            if (watch.writer.handle && (failed || events & EPOLLOUT)) {
+                m_ready.push_back(watch.writer.handle);
+                watch.writer = {};
+            }
+            if (interest(watch) == 0) {
+                epoll_ctl(m_epoll, EPOLL_CTL_DEL, fd, nullptr);
+                m_watches.erase(it);
+                return;
+            }
+            epoll_event event{interest(watch), {.fd = fd}};
+            epoll_ctl(m_epoll, EPOLL_CTL_MOD, fd, &event);
+        }
+
+        int m_epoll;
+        std::unordered_map<int, Watch> m_watches;
+        std::vector<std::coroutine_handle<>> m_ready;
+    };
+}
+
+#endif //MULTIPONG_EVENTLOOP_HPP
@@ -0,0 +1,74 @@
+#ifndef MULTIPONG_FRAMEPOOL_HPP
+#define MULTIPONG_FRAMEPOOL_HPP
+
+#include <cstddef>
+#include <new>
+
+namespace coro {
+    // Coroutine frames of the event loop's thread, kept on per size free lists so suspending and finishing thousands of
+    // small coroutines doesn't go through malloc every time. Memory is never given back, the pool only grows to the
+    // largest number of frames alive at once. Frames over maxPooled bytes go straight to operator new.
+    class FramePool {
+    public:
+        static constexpr size_t granularity = 64;
+        static constexpr size_t maxPooled = 1024;
+
+        static void *allocate(size_t size){
+            if (size > maxPooled) return ::operator new(size);
+            Block *&head = instance().m_free[sizeClass(size)];
+            instance().m_live++;
+            if (head == nullptr) return ::operator new(roundUp(size));
+            Block *block = head;
+            head = block->next;
+            return block;
+        }
+
+        static void deallocate(void *pointer, size_t size){
+            if (size > maxPooled) {
+                ::operator delete(pointer);
+                return;
+            }
+            Block *&head = instance().m_free[sizeClass(size)];
+            instance().m_live--;
+            head = new(pointer) Block{head};
+        }
+
+        // Pooled frames currently in use
+        [[nodiscard]] static size_t live(){
+            return instance().m_live;
+        }
+    private:
+        struct Block {
+            Block *next;
+        };
+
+        static FramePool &instance(){
+            thread_local FramePool pool;
+            return pool;
+        }
+
+        static constexpr size_t roundUp(size_t size){
+            return (size + granularity - 1) / granularity * granularity;
+        }
+
+        static constexpr size_t sizeClass(size_t size){
+            return (size + granularity - 1) / granularity;
+        }
+
+        Block *m_free[maxPooled / granularity + 1]{};
+        size_t m_live = 0;
+    };
+
+    // Promise types derive from this to get their frames from the pool
+    struct PooledFrame {
+        static void *operator new(size_t size){
+            return FramePool::allocate(size);
+        }
+
+        static void operator delete(void *pointer, size_t size){
+            FramePool::deallocate(pointer, size);
+        }
+    };
+}
+
+#endif //MULTIPONG_FRAMEPOOL_HPP
@@ -0,0 +1,168 @@
+#ifndef MULTIPONG_TASK_HPP
+#define MULTIPONG_TASK_HPP
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+#include "FramePool.hpp"
+
+namespace coro {
+    template<class T>
+    class Task;
+
+    namespace detail {
+        struct PromiseBase : PooledFrame {
+            std::coroutine_handle<> continuation = std::noop_coroutine();
+            std::exception_ptr exception;
+
+            std::suspend_always initial_suspend() noexcept{
+                return {};
+            }
+
+            // Straight back into whoever awaited the task, no trip through the event loop
+            struct FinalAwaiter {
+                bool await_ready() noexcept{
+                    return false;
+                }
+
+                template<class Promise>
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept{
+                    return handle.promise().continuation;
+                }
+
+                void await_resume() noexcept{
+
+                }
+            };
+
+            FinalAwaiter final_suspend() noexcept{
+                return {};
+            }
+
+            void unhandled_exception(){
+                exception = std::current_exception();
+            }
+        };
+
+        template<class T>
+        struct Promise : PromiseBase {
+            std::optional<T> value;
+
+            Task<T> get_return_object();
+
+            template<class U>
+            void return_value(U &&result){
+                value.emplace(std::forward<U>(result));
+            }
+
+            T take(){
+                if (exception) std::rethrow_exception(exception);
+                return std::move(*value);
+            }
+        };
+
+        template<>
+        struct Promise<void> : PromiseBase {
+            Task<void> get_return_object();
+
+            void return_void(){
+
+            }
+
+            void take(){
+                if (exception) std::rethrow_exception(exception);
+            }
+        };
+    }
+
+    // Lazy coroutine, starts when awaited and resumes the awaiting coroutine when it finishes. Exceptions travel to
+    // the awaiter like with a normal call.
+    template<class T = void>
+    class [[nodiscard]] Task {
+    public:
+        using promise_type = detail::Promise<T>;
+
+        explicit Task(std::coroutine_handle<promise_type> handle) : m_handle(handle){
+
+        }
+
+        Task(Task &&task) noexcept : m_handle(std::exchange(task.m_handle, nullptr)){
+
+        }
+
+        Task &operator=(Task &&task) noexcept{
+            if (this != &task) {
+                if (m_handle) m_handle.destroy();
+                m_handle = std::exchange(task.m_handle, nullptr);
+            }
+            return *this;
+        }
+
+        Task(const Task &) = delete;
+        Task &operator=(const Task &) = delete;
+
+        ~Task(){
+            if (m_handle) m_handle.destroy();
+        }
+
+        bool await_ready() const noexcept{
+            return false;
+        }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept{
+            m_handle.promise().continuation = awaiting;
+            return m_handle;
+        }
+
+        T await_resume(){
+            return m_handle.promise().take();
+        }
+    private:
+        std::coroutine_handle<promise_type> m_handle;
+    };
+
+    namespace detail {
+        template<class T>
+        Task<T> Promise<T>::get_return_object(){
+            return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+        }
+
+        inline Task<void> Promise<void>::get_return_object(){
+            return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+        }
+
+        // Top of a spawned chain, runs right away and frees itself when done
+        struct Detached {
+            struct promise_type : PooledFrame {
+                Detached get_return_object() noexcept{
+                    return {};
+                }
+
+                std::suspend_never initial_suspend() noexcept{
+                    return {};
+                }
+
+                std::suspend_never final_suspend() noexcept{
+                    return {};
+                }
+
+                void return_void(){
+
+                }
+
+                // A spawned task has nobody to report to, it has to handle its own errors
+                void unhandled_exception(){
+                    std::terminate();
+                }
+            };
+        };
+    }
+
+    // Starts a task that nothing awaits, it runs until its first suspension before spawn returns
+    inline detail::Detached spawn(Task<void> task){
+        co_await std::move(task);
+    }
+}
+
+#endif //MULTIPONG_TASK_HPP
@@ -0,0 +1,58 @@
+#ifndef MULTIPONG_SPSCRING_HPP
+#define MULTIPONG_SPSCRING_HPP
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+#include <stdexcept>
+
+namespace lockfree {
+    // Bounded single producer / single consumer queue, neither side ever waits on the other
+    template<class T>
+    class SpscRing {
+    public:
+        explicit SpscRing(size_t capacity) : m_items(capacity), m_mask(capacity - 1){
+            if (capacity == 0 || (capacity & (capacity - 1)) != 0) throw std::invalid_argument("SpscRing");
+        }
+
+        bool tryPush(const T &item){
+            size_t tail = m_tail.load(std::memory_order_relaxed);
+            if (tail - m_cachedHead == m_items.size()){
+                m_cachedHead = m_head.load(std::memory_order_acquire);
+                if (tail - m_cachedHead == m_items.size()) return false;
+            }
+            m_items[tail & m_mask] = item;
+            m_tail.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool tryPop(T &item){
+            size_t head = m_head.load(std::memory_order_relaxed);
+            if (head == m_cachedTail){
+                m_cachedTail = m_tail.load(std::memory_order_acquire);
+                if (head == m_cachedTail) return false;
+            }
+            item = m_items[head & m_mask];
+            m_head.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        [[nodiscard]] size_t capacity() const{
+            return m_items.size();
+        }
+
+        [[nodiscard]] bool empty() const{
+            return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire);
+        }
+    private:
+        std::vector<T> m_items;
+        size_t m_mask;
+        // Producer and consumer indices live on their own cache lines so the two threads don't keep stealing them from each other
+        alignas(64) std::atomic<size_t> m_tail{0};
+        size_t m_cachedHead = 0;
+        alignas(64) std::atomic<size_t> m_head{0};
+        size_t m_cachedTail = 0;
+    };
+}
+
+#endif //MULTIPONG_SPSCRING_HPP
@@ -0,0 +1,186 @@
+#ifndef MULTIPONG_LOGGER_HPP
+#define MULTIPONG_LOGGER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "../lockfree/SpscRing.hpp"
+
+namespace logging {
+    enum Event : unsigned short {
+        PlayerConnected, PlayerDisconnectedLobby, PlayerDisconnected, GameStarting, LowTps, ResultDropped, InputRejected, PlayerWaiting, WaitingPlayerLeft, TickStages, SnapshotInterval, EventCount
+    };
+
+    // Every format takes its arguments as long long, the record only carries integers
+    inline const char *eventFormat(Event event){
+        switch (event){
+            case PlayerConnected: return "[SERVER] P%lld connected";
+            case PlayerDisconnectedLobby: return "[SERVER] P%lld disconnected in lobby";
+            case PlayerDisconnected: return "[SERVER] P%lld disconnected";
+            case GameStarting: return "[SERVER] Starting game";
+            case LowTps: return "[SERVER] Server is running at less than half the set TPS (Running at %lld tps)";
+            case ResultDropped: return "[SERVER] Results queue full, lost the %lld - %lld match";
+            case InputRejected: return "[SERVER] P%lld sent an unexpected input for tick %lld";
+            case PlayerWaiting: return "[SERVER] A player is waiting for a seat (%lld waiting)";
+            case WaitingPlayerLeft: return "[SERVER] A waiting player left (%lld waiting)";
+            case SnapshotInterval: return "[SERVER] P%lld now gets a snapshot every %lld ticks (estimated delay %lldus)";
+            case TickStages: return "[SERVER] Per tick: receive and simulate %lldns, send stage %lldns, stalled on the send stage %lldns";
+            default: return "[SERVER] Unknown event %lld";
+        }
+    }
+
+    struct Record {
+        long long timestamp;
+        Event event;
+        long long args[3];
+    };
+
+    // Hot path calls only copy a Record into the calling thread's ring, formatting and writing happen on the logger's own
+    // thread so a slow stdout can never stall a tick. When a ring is full the record is counted and dropped.
+    class Logger {
+    public:
+        static constexpr size_t ringCapacity = 1024;
+        static constexpr int ratePerSecond = 50; // Per event, bursts of twice that are let through
+        static constexpr std::chrono::milliseconds flushInterval{5};
+
+        explicit Logger(int fd = STDOUT_FILENO) : m_fd(fd){
+            for (int i = 0; i < EventCount; i++) m_tokens[i] = ratePerSecond * 2.;
+            m_thread = std::thread([this]{ run(); });
+        }
+
+        Logger(const Logger &) = delete;
+        Logger &operator=(const Logger &) = delete;
+
+        ~Logger(){
+            m_running.store(false, std::memory_order_relaxed);
+            m_thread.join();
+        }
+
+        void log(Event event, long long a = 0, long long b = 0, long long c = 0){
+            Ring &ring = threadRing();
+            Record record{std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count(), event, {a, b, c}};
+            if (!ring.records.tryPush(record)) ring.dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        [[nodiscard]] unsigned long long dropped() const{
+            return m_dropped.load(std::memory_order_relaxed);
+        }
+
+        [[nodiscard]] std::thread::native_handle_type nativeHandle(){
+            return m_thread.native_handle();
+        }
+    private:
+        struct Ring {
+            lockfree::SpscRing<Record> records{ringCapacity};
+            std::atomic<unsigned long long> dropped{0};
+        };
+
+        Ring &threadRing(){
+            // Only the first call on each thread takes the lock, rings are never freed so a record outlives its thread
+            thread_local Ring *ring = nullptr;
+            thread_local const Logger *owner = nullptr;
+            if (ring == nullptr || owner != this){
+                std::lock_guard lock(m_ringsMutex);
+                m_rings.push_back(std::make_unique<Ring>());
+                ring = m_rings.back().get();
+                owner = this;
+            }
+            return *ring;
+        }
+
+        void run(){
+            std::string batch;
+            auto last = std::chrono::steady_clock::now();
+            while (true){
+                bool running = m_running.load(std::memory_order_relaxed);
+                auto now = std::chrono::steady_clock::now();
+                double elapsed = std::chrono::duration<double>(now - last).count();
+                last = now;
+                for (double &tokens : m_tokens){
+                    tokens += elapsed * ratePerSecond;
+                    if (tokens > ratePerSecond * 2.) tokens = ratePerSecond * 2.;
+                }
+                std::vector<Ring *> rings;
+                {
+                    std::lock_guard lock(m_ringsMutex);
+                    for (auto &ring : m_rings) rings.push_back(ring.get());
+                }
+                unsigned long long dropped = 0;
+                Record record{};
+                for (Ring *ring : rings){
+                    while (ring->records.tryPop(record)) format(batch, record);
+                    dropped += ring->dropped.exchange(0, std::memory_order_relaxed);
+                }
+                for (int i = 0; i < EventCount; i++){
+                    if (m_suppressed[i] == 0 || m_tokens[i] < 1) continue;
+                    append(batch, "[LOG] %llu \"%s\" messages suppressed\n", m_suppressed[i], eventFormat((Event)i));
+                    m_suppressed[i] = 0;
+                }
+                if (dropped != 0){
+                    m_dropped.fetch_add(dropped, std::memory_order_relaxed);
+                    append(batch, "[LOG] %llu messages dropped, logging fell behind\n", dropped);
+                }
+                write(batch);
+                batch.clear();
+                if (!running) break;
+                std::this_thread::sleep_for(flushInterval);
+            }
+        }
+
+        void format(std::string &batch, const Record &record){
+            if (record.event >= EventCount) return;
+            if (m_tokens[record.event] < 1){
+                m_suppressed[record.event]++;
+                return;
+            }
+            m_tokens[record.event]--;
+            long long seconds = record.timestamp / 1000000000;
+            append(batch, "[%lld.%06lld] ", seconds, record.timestamp % 1000000000 / 1000);
+            append(batch, eventFormat(record.event), record.args[0], record.args[1], record.args[2]);
+            batch += '\n';
+        }
+
+        template<class... Args>
+        static void append(std::string &batch, const char *format, Args... args){
+            char line[256];
+            int length = std::snprintf(line, sizeof(line), format, args...);
+            if (length > 0) batch.append(line, std::min<size_t>(length, sizeof(line) - 1));
+        }
+
+        void write(const std::string &batch) const{
+            size_t written = 0;
+            while (written < batch.size()){
+                ssize_t res = ::write(m_fd, batch.data() + written, batch.size() - written);
+                if (res <= 0) return;
+                written += res;
+            }
+        }
+
+        int m_fd;
+        std::atomic<bool> m_running{true};
+        std::atomic<unsigned long long> m_dropped{0};
+        std::mutex m_ringsMutex;
+        std::vector<std::unique_ptr<Ring>> m_rings;
+        double m_tokens[EventCount]{};
+        unsigned long long m_suppressed[EventCount]{};
+        std::thread m_thread;
+    };
+
+    inline Logger &logger(){
+        static Logger logger;
+        return logger;
+    }
+
+    inline void log(Event event, long long a = 0, long long b = 0, long long c = 0){
+        logger().log(event, a, b, c);
+    }
+}
+
+#endif //MULTIPONG_LOGGER_HPP
@@ -0,0 +1,280 @@
+#ifndef MULTIPONG_ARENA_HPP
+#define MULTIPONG_ARENA_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "Protocol.hpp"
+
+namespace pong {
+    // Arena mode: any number of pads split in two teams and lots of balls that also bounce off each other.
+    // Entities live in parallel arrays, and collisions only look at balls sharing a cell of a uniform grid, so a tick
+    // costs about the number of balls instead of its square.
+    class Arena {
+    public:
+        static constexpr int maxPlayers = 32;
+        static constexpr int maxBalls = 2048;
+        static constexpr int padsPerColumn = 4;
+        static constexpr double columnSpacing = 60;
+        static constexpr int cellSize = 20; // At least a ball wide, touching balls are never more than one cell apart
+        static constexpr int gridColumns = WIN_SIZEX / cellSize, gridRows = WIN_SIZEY / cellSize;
+
+        // Even players are on the left team and odd ones on the right. Each team stacks its pads in columns of
+        // padsPerColumn, every pad moving in its own band.
+        Arena(int players, int balls){
+            for (int i = 0; i < players; i++){
+                int team = i % 2, index = i / 2, teamSize = (players + 1 - team) / 2;
+                int rows = std::min(teamSize, padsPerColumn);
+                int column = index / padsPerColumn, row = index % padsPerColumn;
+                double band = (double)WIN_SIZEY / rows;
+                double x = PAD_OFFST + column * columnSpacing;
+                m_padX.push_back(team == 0 ? x : WIN_SIZEX - x);
+                m_padY.push_back(band * (row + .5));
+                m_padMin.push_back(band * row + PAD_SIZEY / 2.);
+                m_padMax.push_back(band * (row + 1) - PAD_SIZEY / 2.);
+            }
+            m_ballX.resize(balls);
+            m_ballY.resize(balls);
+            m_ballVX.resize(balls);
+            m_ballVY.resize(balls);
+            for (int i = 0; i < balls; i++){
+                serve(i, i % 2);
+                m_ballX[i] = random(WIN_SIZEX / 3., WIN_SIZEX * 2 / 3.);
+                m_ballY[i] = random(BALL_SIZE, WIN_SIZEY - BALL_SIZE);
+            }
+            m_cellStart.resize(gridColumns * gridRows + 1);
+            m_cellCursor.resize(gridColumns * gridRows);
+            m_cellBalls.resize(balls);
+            m_ballCell.resize(balls);
+        }
+
+        void movePad(int player, int direction){
+            double &pad = m_padY[player];
+            pad = std::clamp(pad + direction * (double)PAD_SPEED / TPS, m_padMin[player], m_padMax[player]);
+        }
+
+        void step(){
+            moveBalls();
+            buildGrid();
+            collideBalls();
+            collidePads();
+        }
+
+        [[nodiscard]] int pads() const{
+            return (int)m_padX.size();
+        }
+
+        [[nodiscard]] int balls() const{
+            return (int)m_ballX.size();
+        }
+
+        [[nodiscard]] int entities() const{
+            return pads() + balls();
+        }
+
+        // Ids below pads() are pads, the rest are balls
+        [[nodiscard]] double x(int id) const{
+            return id < pads() ? m_padX[id] : m_ballX[id - pads()];
+        }
+
+        [[nodiscard]] double y(int id) const{
+            return id < pads() ? m_padY[id] : m_ballY[id - pads()];
+        }
+
+        [[nodiscard]] const std::vector<double> &padX() const{
+            return m_padX;
+        }
+
+        [[nodiscard]] const int (&scores() const)[2]{
+            return m_scores;
+        }
+
+        // Narrow phase tests run by the last steps, for comparing against the all pairs count
+        [[nodiscard]] unsigned long long pairsTested() const{
+            return m_pairsTested;
+        }
+    private:
+        // xorshift, only used to spread serves around
+        double random(double low, double high){
+            m_seed ^= m_seed << 13;
+            m_seed ^= m_seed >> 17;
+            m_seed ^= m_seed << 5;
+            return low + (high - low) * (m_seed / 4294967296.);
+        }
+
+        // From the middle towards the given team's side, a bit up or down
+        void serve(int ball, int team){
+            double angle = random(-M_PI_4, M_PI_4) + (team == 0 ? M_PI : 0);
+            m_ballX[ball] = WIN_SIZEX / 2.;
+            m_ballY[ball] = random(WIN_SIZEY / 4., WIN_SIZEY * 3 / 4.);
+            m_ballVX[ball] = std::cos(angle) * BALL_DSPD;
+            m_ballVY[ball] = -std::sin(angle) * BALL_DSPD;
+        }
+
+        void speedUp(int ball){
+            double speed = std::hypot(m_ballVX[ball], m_ballVY[ball]);
+            double scale = std::min(speed * 1.1, (double)BALL_MSPD) / speed;
+            m_ballVX[ball] *= scale;
+            m_ballVY[ball] *= scale;
+        }
+
+        void moveBalls(){
+            for (int i = 0; i < balls(); i++){
+                m_ballX[i] += m_ballVX[i] / TPS;
+                m_ballY[i] += m_ballVY[i] / TPS;
+                if (m_ballY[i] < 5){
+                    m_ballY[i] = 5;
+                    m_ballVY[i] = std::abs(m_ballVY[i]);
+                    speedUp(i);
+                }
+                if (m_ballY[i] > WIN_SIZEY - 5){
+                    m_ballY[i] = WIN_SIZEY - 5;
+                    m_ballVY[i] = -std::abs(m_ballVY[i]);
+                    speedUp(i);
+                }
+                if (m_ballX[i] + BALL_SIZE / 2. < 0){
+                    m_scores[1]++;
+                    serve(i, 1);
+                }
+                else if (m_ballX[i] - BALL_SIZE / 2. >= WIN_SIZEX){
+                    m_scores[0]++;
+                    serve(i, 0);
+                }
+            }
+        }
+
+        [[nodiscard]] static int cellOf(double x, double y){
+            int column = std::clamp((int)(x / cellSize), 0, gridColumns - 1);
+            int row = std::clamp((int)(y / cellSize), 0, gridRows - 1);
+            return row * gridColumns + column;
+        }
+
+        // Counting sort of the balls by cell, the balls of cell c end up in m_cellBalls[m_cellStart[c]..m_cellStart[c + 1])
+        void buildGrid(){
+            std::fill(m_cellStart.begin(), m_cellStart.end(), 0);
+            for (int i = 0; i < balls(); i++){
+                m_ballCell[i] = cellOf(m_ballX[i], m_ballY[i]);
+                m_cellStart[m_ballCell[i] + 1]++;
+            }
+            for (size_t cell = 1; cell < m_cellStart.size(); cell++) m_cellStart[cell] += m_cellStart[cell - 1];
+            std::copy(m_cellStart.begin(), m_cellStart.end() - 1, m_cellCursor.begin());
+            for (int i = 0; i < balls(); i++) m_cellBalls[m_cellCursor[m_ballCell[i]]++] = i;
+        }
+
+        void collideBalls(){
+            m_pairsTested = 0;
+            // Half the neighbourhood so every pair of cells is visited once
+            constexpr int neighbours[4][2]{{1, 0}, {-1, 1}, {0, 1}, {1, 1}};
+            for (int row = 0; row < gridRows; row++){
+                for (int column = 0; column < gridColumns; column++){
+                    int cell = row * gridColumns + column;
+                    for (int a = m_cellStart[cell]; a < m_cellStart[cell + 1]; a++){
+                        for (int b = a + 1; b < m_cellStart[cell + 1]; b++) collide(m_cellBalls[a], m_cellBalls[b]);
+                        for (const auto &offset : neighbours){
+                            int otherColumn = column + offset[0], otherRow = row + offset[1];
+                            if (otherColumn < 0 || otherColumn >= gridColumns || otherRow >= gridRows) continue;
+                            int other = otherRow * gridColumns + otherColumn;
+                            for (int b = m_cellStart[other]; b < m_cellStart[other + 1]; b++) collide(m_cellBalls[a], m_cellBalls[b]);
+                        }
+                    }
+                }
+            }
+        }
+
+        // Balls are round here, equal masses swap their velocity along the line between them
+        void collide(int a, int b){
+            m_pairsTested++;
+            double dx = m_ballX[b] - m_ballX[a], dy = m_ballY[b] - m_ballY[a];
+            double distance2 = dx * dx + dy * dy;
+            if (distance2 >= BALL_SIZE * BALL_SIZE || distance2 == 0) return;
+            double distance = std::sqrt(distance2), nx = dx / distance, ny = dy / distance;
+            double push = (BALL_SIZE - distance) / 2;
+            m_ballX[a] -= nx * push;
+            m_ballY[a] -= ny * push;
+            m_ballX[b] += nx * push;
+            m_ballY[b] += ny * push;
+            double closing = (m_ballVX[a] - m_ballVX[b]) * nx + (m_ballVY[a] - m_ballVY[b]) * ny;
+            if (closing <= 0) return;
+            m_ballVX[a] -= closing * nx;
+            m_ballVY[a] -= closing * ny;
+            m_ballVX[b] += closing * nx;
+            m_ballVY[b] += closing * ny;
+        }
+
+        // Same bounce as the two player game, a ball only bounces when heading for the pad's own goal
+        void collidePads(){
+            for (int pad = 0; pad < pads(); pad++){
+                double left = m_padX[pad] - PAD_SIZEX / 2., top = m_padY[pad] - PAD_SIZEY / 2.;
+                int firstColumn = cellOf(left - BALL_SIZE, 0) % gridColumns, lastColumn = cellOf(left + PAD_SIZEX + BALL_SIZE, 0) % gridColumns;
+                int firstRow = cellOf(0, top - BALL_SIZE) / gridColumns, lastRow = cellOf(0, top + PAD_SIZEY + BALL_SIZE) / gridColumns;
+                bool leftTeam = pad % 2 == 0;
+                for (int row = firstRow; row <= lastRow; row++){
+                    for (int column = firstColumn; column <= lastColumn; column++){
+                        int cell = row * gridColumns + column;
+                        for (int i = m_cellStart[cell]; i < m_cellStart[cell + 1]; i++){
+                            int ball = m_cellBalls[i];
+                            double ballLeft = m_ballX[ball] - BALL_SIZE / 2., ballTop = m_ballY[ball] - BALL_SIZE / 2.;
+                            if (ballLeft >= left + PAD_SIZEX || ballLeft + BALL_SIZE <= left ||
+                                ballTop >= top + PAD_SIZEY || ballTop + BALL_SIZE <= top) continue;
+                            if (leftTeam ? m_ballVX[ball] >= 0 : m_ballVX[ball] <= 0) continue;
+                            double distance = (leftTeam ? m_padY[pad] - m_ballY[ball] : m_ballY[ball] - m_padY[pad]) / PAD_SIZEY * 2.;
+                            double angle = distance * M_PI_4 + (leftTeam ? 0 : M_PI);
+                            double speed = std::min(std::hypot(m_ballVX[ball], m_ballVY[ball]) * 1.1, (double)BALL_MSPD);
+                            m_ballX[ball] = m_padX[pad] + (leftTeam ? 1 : -1) * (PAD_SIZEX / 2. + BALL_SIZE / 2.);
+                            m_ballVX[ball] = std::cos(angle) * speed;
+                            m_ballVY[ball] = -std::sin(angle) * speed;
+                        }
+                    }
+                }
+            }
+        }
+
+        std::vector<double> m_padX, m_padY, m_padMin, m_padMax;
+        std::vector<double> m_ballX, m_ballY, m_ballVX, m_ballVY;
+        std::vector<int> m_cellStart, m_cellCursor, m_cellBalls, m_ballCell;
+        int m_scores[2]{};
+        unsigned int m_seed = 2463534242u;
+        unsigned long long m_pairsTested = 0;
+    };
+
+    // What one client was last sent of every entity. Updates only carry entities that drifted from that by more than
+    // the threshold, so a ball is sent every few ticks instead of every tick and whatever a client missed while its
+    // link was busy is in the next update. An update holds at most maxEntities, the scan picks up where the last one
+    // stopped so every entity gets its turn. A fresh view knows nothing, its first updates are the whole arena.
+    class ArenaView {
+    public:
+        static constexpr float ballThreshold = 4; // Pixels, well under a ball. Pads always go out exact.
+        static constexpr size_t maxEntities = 512;
+
+        void update(const Arena &arena, std::vector<EntityUpdate> &out){
+            int count = arena.entities();
+            if ((int)m_x.size() != count){
+                m_x.assign(count, NAN);
+                m_y.assign(count, NAN);
+                m_next = 0;
+            }
+            size_t added = 0;
+            for (int i = 0; i < count && added < maxEntities; i++){
+                int id = (m_next + i) % count;
+                auto fx = (float)arena.x(id), fy = (float)arena.y(id);
+                float threshold = id < arena.pads() ? 0 : ballThreshold;
+                // A fresh view holds NaN, every comparison with it is false so the entity goes out
+                if (std::abs(fx - m_x[id]) <= threshold && std::abs(fy - m_y[id]) <= threshold) continue;
+                m_x[id] = fx;
+                m_y[id] = fy;
+                out.push_back({(unsigned short)id, fx, fy});
+                if (++added == maxEntities) m_next = (id + 1) % count;
+            }
+        }
+
+        void reset(){
+            m_x.clear();
+            m_y.clear();
+        }
+    private:
+        std::vector<float> m_x, m_y;
+        int m_next = 0;
+    };
+}
+
+#endif //MULTIPONG_ARENA_HPP
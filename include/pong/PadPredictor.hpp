@@ -0,0 +1,49 @@
+#ifndef MULTIPONG_PADPREDICTOR_HPP
+#define MULTIPONG_PADPREDICTOR_HPP
+
+#include <vector>
+#include <algorithm>
+#include "Simulation.hpp"
+
+namespace pong {
+    // Moves the local pad as soon as an input is sent, then replays the inputs the server hasn't acked yet
+    // on top of every authoritative position it receives
+    class PadPredictor {
+    public:
+        PadInput input(int direction){
+            PadInput input{direction, ++m_sequence};
+            m_pending.push_back(input);
+            m_position = FloatSimulation::stepPad(m_position, direction, m_tickRate);
+            return input;
+        }
+
+        void reconcile(double authoritative, unsigned int lastInput){
+            std::erase_if(m_pending, [lastInput](const PadInput &input){ return input.sequence <= lastInput; });
+            m_position = authoritative;
+            for (const PadInput &input : m_pending)
+                m_position = FloatSimulation::stepPad(m_position, input.direction, m_tickRate);
+        }
+
+        // tickRate is the server's, every input moves the pad one of its ticks worth
+        void reset(double position, int tickRate = TPS){
+            m_pending.clear();
+            m_position = position;
+            m_tickRate = tickRate;
+        }
+
+        [[nodiscard]] double position() const{
+            return m_position;
+        }
+
+        [[nodiscard]] size_t pending() const{
+            return m_pending.size();
+        }
+    private:
+        std::vector<PadInput> m_pending;
+        unsigned int m_sequence = 0;
+        double m_position = WIN_SIZEY / 2.;
+        int m_tickRate = TPS;
+    };
+}
+
+#endif //MULTIPONG_PADPREDICTOR_HPP
@@ -0,0 +1,181 @@
+#ifndef MULTIPONG_PHYSICS_HPP
+#define MULTIPONG_PHYSICS_HPP
+
+#include <array>
+#include <cmath>
+
+namespace pong {
+    // Number policies for Simulation. Both expose the same names so the game logic is written once:
+    // Scalar for distances and speeds, Angle for directions, and the few angle operations the game needs.
+
+    // The original double arithmetic, results depend on the compiler, its flags and the libm it links against
+    struct FloatPhysics {
+        using Scalar = double;
+        using Angle = double;
+
+        static constexpr Scalar ratio(long long numerator, long long denominator){
+            return (double)numerator / (double)denominator;
+        }
+
+        static constexpr Angle zero(){
+            return 0;
+        }
+
+        static constexpr Angle halfTurn(){
+            return M_PI;
+        }
+
+        static Angle reflect(Angle angle){
+            return M_PI * 2 - angle;
+        }
+
+        static Angle turnHalf(Angle angle){
+            return angle + M_PI;
+        }
+
+        // distance goes from -1 to 1 across a pad, mapped to -45 to 45 degrees
+        static Angle padAngle(Scalar distance){
+            return distance * M_PI_4;
+        }
+
+        static Scalar cos(Angle angle){
+            return std::cos(angle);
+        }
+
+        static Scalar sin(Angle angle){
+            return std::sin(angle);
+        }
+
+        static double toDouble(Scalar value){
+            return value;
+        }
+    };
+
+    // Signed fixed point with 16 fractional bits, every operation is plain integer arithmetic so the same inputs give
+    // the same bits with any compiler or flags
+    class Fixed {
+    public:
+        static constexpr int fractionBits = 16;
+
+        constexpr Fixed() = default;
+
+        constexpr Fixed(int value) : m_raw((long long)value * (1ll << fractionBits)){
+
+        }
+
+        static constexpr Fixed fromRaw(long long raw){
+            Fixed fixed;
+            fixed.m_raw = raw;
+            return fixed;
+        }
+
+        [[nodiscard]] constexpr long long raw() const{
+            return m_raw;
+        }
+
+        [[nodiscard]] constexpr double toDouble() const{
+            return (double)m_raw / (1ll << fractionBits);
+        }
+
+        friend constexpr Fixed operator+(Fixed a, Fixed b){ return fromRaw(a.m_raw + b.m_raw); }
+        friend constexpr Fixed operator-(Fixed a, Fixed b){ return fromRaw(a.m_raw - b.m_raw); }
+        friend constexpr Fixed operator*(Fixed a, Fixed b){ return fromRaw(a.m_raw * b.m_raw >> fractionBits); }
+        friend constexpr Fixed operator/(Fixed a, Fixed b){ return fromRaw(a.m_raw * (1ll << fractionBits) / b.m_raw); }
+        constexpr Fixed operator-() const{ return fromRaw(-m_raw); }
+        constexpr Fixed &operator+=(Fixed b){ m_raw += b.m_raw; return *this; }
+        constexpr Fixed &operator-=(Fixed b){ m_raw -= b.m_raw; return *this; }
+        constexpr Fixed &operator*=(Fixed b){ return *this = *this * b; }
+        friend constexpr bool operator<(Fixed a, Fixed b){ return a.m_raw < b.m_raw; }
+        friend constexpr bool operator>(Fixed a, Fixed b){ return a.m_raw > b.m_raw; }
+        friend constexpr bool operator<=(Fixed a, Fixed b){ return a.m_raw <= b.m_raw; }
+        friend constexpr bool operator>=(Fixed a, Fixed b){ return a.m_raw >= b.m_raw; }
+        friend constexpr bool operator==(Fixed a, Fixed b){ return a.m_raw == b.m_raw; }
+    private:
+        long long m_raw = 0;
+    };
+
+    constexpr int sineTableBits = 10;
+
+    // sin over the first quarter turn in 16 fractional bits, from a Taylor series evaluated in 30 bit integer
+    // fixed point at compile time so no floating point ever gets near it
+    constexpr std::array<int, (1 << sineTableBits) + 1> makeSineTable(){
+        constexpr long long one = 1ll << 30;
+        constexpr long long halfPi = 1686629713; // pi / 2 in 30 fractional bits
+        std::array<int, (1 << sineTableBits) + 1> table{};
+        for (int i = 0; i <= 1 << sineTableBits; i++){
+            long long x = halfPi * i >> sineTableBits;
+            long long x2 = x * x / one;
+            long long term = x, sum = x;
+            for (int k = 1; k < 12; k++){
+                term = -term * x2 / one / ((2 * k) * (2 * k + 1));
+                sum += term;
+            }
+            table[i] = (int)((sum + (1 << 13)) >> 14);
+        }
+        return table;
+    }
+
+    inline constexpr std::array<int, (1 << sineTableBits) + 1> sineTable = makeSineTable();
+
+    struct FixedPhysics {
+        using Scalar = Fixed;
+        using Angle = int; // Binary angle, a full turn is 65536 and it always stays in [0, 65536)
+
+        static constexpr int fullTurn = 1 << 16;
+
+        static constexpr Scalar ratio(long long numerator, long long denominator){
+            return Fixed::fromRaw(numerator * (1ll << Fixed::fractionBits) / denominator);
+        }
+
+        static constexpr Angle zero(){
+            return 0;
+        }
+
+        static constexpr Angle halfTurn(){
+            return fullTurn / 2;
+        }
+
+        static constexpr Angle reflect(Angle angle){
+            return (fullTurn - angle) & (fullTurn - 1);
+        }
+
+        static constexpr Angle turnHalf(Angle angle){
+            return (angle + fullTurn / 2) & (fullTurn - 1);
+        }
+
+        static constexpr Angle padAngle(Scalar distance){
+            // An eighth of a turn per unit of distance, the raw value already carries the 16 fractional bits
+            return (int)((distance.raw() * (fullTurn / 8)) >> Fixed::fractionBits) & (fullTurn - 1);
+        }
+
+        static constexpr Scalar sin(Angle angle){
+            angle &= fullTurn - 1;
+            int quarter = angle / (fullTurn / 4), offset = angle % (fullTurn / 4);
+            switch (quarter){
+                case 0: return Fixed::fromRaw(quarterSine(offset));
+                case 1: return Fixed::fromRaw(quarterSine(fullTurn / 4 - offset));
+                case 2: return Fixed::fromRaw(-quarterSine(offset));
+                default: return Fixed::fromRaw(-quarterSine(fullTurn / 4 - offset));
+            }
+        }
+
+        static constexpr Scalar cos(Angle angle){
+            return sin(angle + fullTurn / 4);
+        }
+
+        static constexpr double toDouble(Scalar value){
+            return value.toDouble();
+        }
+    private:
+        static constexpr int tableShift = 14 - sineTableBits;
+
+        // offset in [0, fullTurn / 4], linear between table entries
+        static constexpr long long quarterSine(int offset){
+            int index = offset >> tableShift, fraction = offset & ((1 << tableShift) - 1);
+            if (index == 1 << sineTableBits) return sineTable[index];
+            return sineTable[index] + (((long long)(sineTable[index + 1] - sineTable[index]) * fraction) >> tableShift);
+        }
+    };
+}
+
+#endif //MULTIPONG_PHYSICS_HPP
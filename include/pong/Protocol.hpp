@@ -0,0 +1,76 @@
+#ifndef MULTIPONG_PROTOCOL_HPP
+#define MULTIPONG_PROTOCOL_HPP
+
+#include <string>
+
+enum MessageType : char {
+    MovePad, Tick, BallUpdate, PadUpdate, ScoreUpdate, PlayerAssignment, GameStart, GameEnd, InputFrame, ArenaLayout, ArenaUpdate
+};
+
+struct __attribute__((packed)) MessageHeader {
+    MessageType type;
+    unsigned int length;
+};
+
+struct Message {
+    MessageHeader header{MovePad, 0};
+    std::string data;
+};
+
+struct Position {
+    double x, y;
+};
+
+// Payload of MovePad, the sequence number is acked back in TickInfo so the client can drop the inputs the server already applied
+struct __attribute__((packed)) PadInput {
+    int direction;
+    unsigned int sequence;
+};
+
+// Payload of Tick, sent after the tick's BallUpdate and PadUpdate so the client knows the snapshot is complete
+struct __attribute__((packed)) TickInfo {
+    unsigned int tick;
+    unsigned int lastInput;
+};
+
+enum GameMode : unsigned char {
+    ServerAuthoritative, Rollback, Arena
+};
+
+// Payload of GameStart, an empty GameStart means ServerAuthoritative. Older servers leave out tickRate, which means TPS.
+struct __attribute__((packed)) GameSettings {
+    GameMode mode;
+    unsigned char inputDelay;
+    unsigned short tickRate;
+};
+
+// Payload of InputFrame in rollback mode, one per player per tick. Clients send their own and the server relays it to the opponent.
+struct __attribute__((packed)) TickInput {
+    unsigned int tick;
+    int direction;
+};
+
+// Payload of ArenaLayout, followed by the x of every pad as a float. Pad i belongs to player i + 1.
+struct __attribute__((packed)) ArenaInfo {
+    unsigned short pads;
+    unsigned short balls;
+};
+
+// Payload of ArenaUpdate is a list of these, only for entities that moved far enough. Ids below the pad count are pads, the rest are balls.
+struct __attribute__((packed)) EntityUpdate {
+    unsigned short id;
+    float x, y;
+};
+
+#define WIN_SIZEX 800
+#define WIN_SIZEY 600
+#define PAD_SIZEX 10
+#define PAD_SIZEY 80
+#define BALL_SIZE 10
+#define PAD_OFFST 20
+#define PAD_SPEED 350
+#define BALL_DSPD 400
+#define BALL_MSPD 600
+#define TPS 144
+
+#endif //MULTIPONG_PROTOCOL_HPP
@@ -0,0 +1,158 @@
+#ifndef MULTIPONG_ROLLBACK_HPP
+#define MULTIPONG_ROLLBACK_HPP
+
+#include <algorithm>
+#include <deque>
+#include <limits>
+#include <type_traits>
+#include "Simulation.hpp"
+
+namespace pong {
+    // Both clients and the server have to land on the same bits, so rollback always runs on fixed point
+    using RollbackSimulation = FixedSimulation;
+
+    static_assert(std::is_trivially_copyable_v<RollbackSimulation::State>, "Rollback saves and restores states with plain copies");
+
+    // A client's copy of the match. It runs ahead on its own inputs and a guess of the opponent's, keeps the state of every
+    // recent tick, and when a real input turns out different from the guess it rewinds to that tick and simulates back up.
+    class RollbackSession {
+    public:
+        static constexpr unsigned historySize = 128;
+        static constexpr unsigned maxPrediction = 32; // Ticks past the opponent's last input, also the longest replay
+        static constexpr unsigned maxInputDelay = 16;
+
+        RollbackSession(int localPlayer, unsigned inputDelay, int tickRate = TPS) : m_local(localPlayer - 1), m_state(RollbackSimulation::start(tickRate)){
+            inputDelay = std::min(inputDelay, maxInputDelay);
+            // Nobody can have pressed anything for the ticks before the first delayed input
+            for (unsigned tick = 0; tick < inputDelay; tick++){
+                m_inputs[0][tick] = 0;
+                m_inputs[1][tick] = 0;
+            }
+            m_known[0] = m_known[1] = inputDelay;
+            m_states[0] = m_state;
+        }
+
+        // Past maxPrediction unconfirmed ticks we wait for the opponent instead of guessing further
+        [[nodiscard]] bool canAdvance() const{
+            return m_tick < m_known[1 - m_local] + maxPrediction;
+        }
+
+        // Schedules the local direction inputDelay ticks ahead, the result is what goes out in InputFrame
+        TickInput localInput(int direction){
+            unsigned tick = m_known[m_local]++;
+            m_inputs[m_local][tick % historySize] = direction;
+            return {tick, direction};
+        }
+
+        // Returns false for an input that isn't the next one expected from the opponent
+        bool remoteInput(const TickInput &input){
+            int remote = 1 - m_local;
+            if (input.tick != m_known[remote] || input.tick >= m_tick + historySize - maxPrediction) return false;
+            int &slot = m_inputs[remote][input.tick % historySize];
+            // A tick we already ran holds the guess we ran it with
+            if (input.tick < m_tick && slot != input.direction) m_rewind = std::min(m_rewind, input.tick);
+            slot = input.direction;
+            m_known[remote]++;
+            return true;
+        }
+
+        // Replays from the oldest mispredicted tick if there is one, then simulates the next tick
+        void advance(){
+            if (m_rewind < m_tick){
+                unsigned target = m_tick;
+                m_state = m_states[m_rewind % historySize];
+                m_resimulated += target - m_rewind;
+                m_rollbacks++;
+                for (m_tick = m_rewind; m_tick < target;) simulate();
+            }
+            m_rewind = std::numeric_limits<unsigned>::max();
+            simulate();
+        }
+
+        [[nodiscard]] const RollbackSimulation::State &state() const{
+            return m_state;
+        }
+
+        [[nodiscard]] unsigned tick() const{
+            return m_tick;
+        }
+
+        [[nodiscard]] unsigned long long rollbacks() const{
+            return m_rollbacks;
+        }
+
+        [[nodiscard]] unsigned long long resimulated() const{
+            return m_resimulated;
+        }
+    private:
+        void simulate(){
+            int directions[2];
+            for (int player = 0; player < 2; player++){
+                int &slot = m_inputs[player][m_tick % historySize];
+                // Not heard from them yet, guess they kept doing what they did last
+                if (m_tick >= m_known[player]) slot = m_known[player] == 0 ? 0 : m_inputs[player][(m_known[player] - 1) % historySize];
+                directions[player] = slot;
+            }
+            RollbackSimulation::advance(m_state, directions);
+            m_tick++;
+            m_states[m_tick % historySize] = m_state;
+        }
+
+        int m_local;
+        RollbackSimulation::State m_state;
+        RollbackSimulation::State m_states[historySize]{}; // m_states[t % historySize] is the state before tick t ran
+        int m_inputs[2][historySize]{};
+        unsigned m_known[2]{}; // Inputs are known for every tick below this
+        unsigned m_tick = 0;
+        unsigned m_rewind = std::numeric_limits<unsigned>::max();
+        unsigned long long m_rollbacks = 0, m_resimulated = 0;
+    };
+
+    // The server's copy of the match, run only on confirmed inputs so it has the final say on the score
+    class RollbackArbiter {
+    public:
+        explicit RollbackArbiter(unsigned inputDelay, int tickRate = TPS) : m_state(RollbackSimulation::start(tickRate)){
+            inputDelay = std::min(inputDelay, RollbackSession::maxInputDelay);
+            m_pending[0].assign(inputDelay, 0);
+            m_pending[1].assign(inputDelay, 0);
+            m_next[0] = m_next[1] = inputDelay;
+        }
+
+        // Returns false for an input that is out of order, not a direction, or too far ahead of the other player's
+        bool input(int player, const TickInput &input){
+            if (input.tick != m_next[player] || input.direction < -1 || input.direction > 1) return false;
+            if (m_pending[player].size() >= RollbackSession::historySize) return false;
+            m_pending[player].push_back(input.direction);
+            m_next[player]++;
+            return true;
+        }
+
+        [[nodiscard]] bool ready() const{
+            return !m_pending[0].empty() && !m_pending[1].empty();
+        }
+
+        // Runs the next confirmed tick, returns the player who scored or 0
+        int step(){
+            int directions[2]{m_pending[0].front(), m_pending[1].front()};
+            m_pending[0].pop_front();
+            m_pending[1].pop_front();
+            m_tick++;
+            return RollbackSimulation::advance(m_state, directions);
+        }
+
+        [[nodiscard]] const RollbackSimulation::State &state() const{
+            return m_state;
+        }
+
+        [[nodiscard]] unsigned tick() const{
+            return m_tick;
+        }
+    private:
+        RollbackSimulation::State m_state;
+        std::deque<int> m_pending[2];
+        unsigned m_next[2]{};
+        unsigned m_tick = 0;
+    };
+}
+
+#endif //MULTIPONG_ROLLBACK_HPP
@@ -0,0 +1,128 @@
+#ifndef MULTIPONG_SIMULATION_HPP
+#define MULTIPONG_SIMULATION_HPP
+
+#include "Protocol.hpp"
+#include "Physics.hpp"
+
+namespace pong {
+    template<class Physics>
+    struct MatchState {
+        typename Physics::Scalar ballX, ballY;
+        typename Physics::Angle ballDirection;
+        typename Physics::Scalar ballSpeed;
+        typename Physics::Scalar pads[2];
+        int scores[2];
+        int tickRate; // Ticks per second, everything moves by its speed over this per step
+    };
+
+    // The game rules, written once against the Physics policy. FloatPhysics reproduces the original double code,
+    // FixedPhysics gives bit-identical results on any build.
+    template<class Physics>
+    class Simulation {
+    public:
+        using Scalar = typename Physics::Scalar;
+        using Angle = typename Physics::Angle;
+        using State = MatchState<Physics>;
+
+        static State start(int tickRate = TPS){
+            State state{};
+            state.tickRate = tickRate;
+            state.ballX = Scalar(WIN_SIZEX) / 2;
+            state.ballY = Scalar(WIN_SIZEY) / 2;
+            state.ballDirection = Physics::halfTurn();
+            state.ballSpeed = BALL_DSPD;
+            state.pads[0] = Scalar(WIN_SIZEY) / 2;
+            state.pads[1] = Scalar(WIN_SIZEY) / 2;
+            return state;
+        }
+
+        // Moves a pad by one MovePad worth of distance
+        static Scalar stepPad(Scalar pad, int direction, int tickRate = TPS){
+            pad += Scalar(direction * PAD_SPEED) / tickRate;
+            if (pad - Scalar(PAD_SIZEY) / 2 < 0) pad = Scalar(PAD_SIZEY) / 2;
+            if (pad + Scalar(PAD_SIZEY) / 2 >= WIN_SIZEY) pad = WIN_SIZEY - Scalar(PAD_SIZEY) / 2;
+            return pad;
+        }
+
+        // Advances the ball by one tick, returns the player who scored or 0
+        static int step(State &state){
+            int scored = 0;
+            state.ballX += Physics::cos(state.ballDirection) * state.ballSpeed / state.tickRate;
+            state.ballY += -Physics::sin(state.ballDirection) * state.ballSpeed / state.tickRate;
+            if (state.ballX + Scalar(BALL_SIZE) / 2 < 0){
+                state.scores[1]++;
+                serve(state, Physics::zero());
+                scored = 2;
+            }
+            if (state.ballX - Scalar(BALL_SIZE) / 2 >= WIN_SIZEX){
+                state.scores[0]++;
+                serve(state, Physics::halfTurn());
+                scored = 1;
+            }
+            if (state.ballY < 5){
+                state.ballY = 5;
+                state.ballDirection = Physics::reflect(state.ballDirection);
+                speedUp(state);
+            }
+            if (state.ballY > WIN_SIZEY - 5){
+                state.ballY = WIN_SIZEY - 5;
+                state.ballDirection = Physics::reflect(state.ballDirection);
+                speedUp(state);
+            }
+            if (rectIntersect(state.ballX - Scalar(BALL_SIZE) / 2, state.ballY - Scalar(BALL_SIZE) / 2, BALL_SIZE, BALL_SIZE,
+                              PAD_OFFST - Scalar(PAD_SIZEX) / 2, state.pads[0] - Scalar(PAD_SIZEY) / 2, PAD_SIZEX, PAD_SIZEY)){
+                state.ballX = PAD_OFFST + Scalar(PAD_SIZEX) / 2 + Scalar(BALL_SIZE) / 2;
+                Scalar distance = (state.pads[0] - state.ballY) / PAD_SIZEY * 2;
+                state.ballDirection = Physics::padAngle(distance);
+                speedUp(state);
+            }
+            if (rectIntersect(state.ballX - Scalar(BALL_SIZE) / 2, state.ballY - Scalar(BALL_SIZE) / 2, BALL_SIZE, BALL_SIZE,
+                              WIN_SIZEX - PAD_OFFST - Scalar(PAD_SIZEX) / 2, state.pads[1] - Scalar(PAD_SIZEY) / 2, PAD_SIZEX, PAD_SIZEY)){
+                state.ballX = WIN_SIZEX - PAD_OFFST - Scalar(PAD_SIZEX) / 2 - Scalar(BALL_SIZE) / 2;
+                Scalar distance = (state.ballY - state.pads[1]) / PAD_SIZEY * 2;
+                state.ballDirection = Physics::turnHalf(Physics::padAngle(distance));
+                speedUp(state);
+            }
+            return scored;
+        }
+
+        // One tick of a match driven by exactly one input per player, the way rollback mode runs it
+        static int advance(State &state, const int (&directions)[2]){
+            state.pads[0] = stepPad(state.pads[0], directions[0], state.tickRate);
+            state.pads[1] = stepPad(state.pads[1], directions[1], state.tickRate);
+            return step(state);
+        }
+
+        static Position ball(const State &state){
+            return {Physics::toDouble(state.ballX), Physics::toDouble(state.ballY)};
+        }
+
+        static double pad(const State &state, int player){
+            return Physics::toDouble(state.pads[player]);
+        }
+    private:
+        static bool rectIntersect(Scalar x1, Scalar y1, Scalar w1, Scalar h1, Scalar x2, Scalar y2, Scalar w2, Scalar h2){
+            return x1 < x2 + w2 &&
+                   x1 + w1 > x2 &&
+                   y1 < y2 + h2 &&
+                   y1 + h1 > y2;
+        }
+
+        static void serve(State &state, Angle direction){
+            state.ballX = Scalar(WIN_SIZEX) / 2;
+            state.ballY = Scalar(WIN_SIZEY) / 2;
+            state.ballDirection = direction;
+            state.ballSpeed = BALL_DSPD;
+        }
+
+        static void speedUp(State &state){
+            state.ballSpeed *= Physics::ratio(11, 10);
+            if (state.ballSpeed > BALL_MSPD) state.ballSpeed = BALL_MSPD;
+        }
+    };
+
+    using FloatSimulation = Simulation<FloatPhysics>;
+    using FixedSimulation = Simulation<FixedPhysics>;
+}
+
+#endif //MULTIPONG_SIMULATION_HPP
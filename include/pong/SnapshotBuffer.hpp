@@ -0,0 +1,98 @@
+#ifndef MULTIPONG_SNAPSHOTBUFFER_HPP
+#define MULTIPONG_SNAPSHOTBUFFER_HPP
+
+#include <algorithm>
+#include <vector>
+#include <cmath>
+#include "Protocol.hpp"
+
+namespace pong {
+    struct Snapshot {
+        unsigned int tick;
+        Position ball;
+        double pads[2];
+    };
+
+    // Keeps the last few server snapshots and renders a fixed delay behind the newest one, so the
+    // displayed state moves at the server's pace instead of jumping whenever a packet arrives
+    class SnapshotBuffer {
+    public:
+        explicit SnapshotBuffer(double delayTicks = 3, size_t capacity = 64) : m_delay(delayTicks), m_snapshots(capacity){
+
+        }
+
+        // now is the local time in seconds at which the snapshot was received
+        void push(const Snapshot &snapshot, double now){
+            if (m_size != 0 && snapshot.tick <= newest().tick) return;
+            if (m_size != 0) m_gap += (snapshot.tick - newest().tick - m_gap) * 0.1;
+            double offset = now - snapshot.tick / (double)m_tickRate;
+            if (m_size == 0)
+                m_offset = offset;
+            else if (offset < m_offset)
+                m_offset = offset; // A snapshot that came early is the best estimate of the real latency, take it right away
+            else
+                m_offset += (offset - m_offset) * 0.02; // Otherwise drift slowly so a single late packet doesn't shift everything
+            m_snapshots[(m_head + m_size) % m_snapshots.size()] = snapshot;
+            if (m_size < m_snapshots.size()) m_size++;
+            else m_head = (m_head + 1) % m_snapshots.size();
+        }
+
+        bool sample(double now, Snapshot &out) const{
+            if (m_size == 0) return false;
+            // When the server sends fewer snapshots the delay stretches so there is still one ahead to interpolate to
+            double renderTick = (now - m_offset) * m_tickRate - std::max(m_delay, m_gap + 1);
+            if (renderTick <= at(0).tick){
+                out = at(0);
+                return true;
+            }
+            for (size_t i = 1; i < m_size; i++){
+                const Snapshot &from = at(i - 1), &to = at(i);
+                if (renderTick >= to.tick) continue;
+                double t = (renderTick - from.tick) / (to.tick - from.tick);
+                out = to;
+                // The ball teleports back to the middle after a point, interpolating that would draw it flying across the field
+                if (std::abs(to.ball.x - from.ball.x) < WIN_SIZEX / 4.){
+                    out.ball.x = from.ball.x + (to.ball.x - from.ball.x) * t;
+                    out.ball.y = from.ball.y + (to.ball.y - from.ball.y) * t;
+                }
+                else if (t < .5)
+                    out.ball = from.ball;
+                out.pads[0] = from.pads[0] + (to.pads[0] - from.pads[0]) * t;
+                out.pads[1] = from.pads[1] + (to.pads[1] - from.pads[1]) * t;
+                return true;
+            }
+            out = newest(); // Ran out of snapshots, hold the last one rather than guessing
+            return true;
+        }
+
+        // Snapshot ticks are counted at the server's tickRate
+        void clear(int tickRate = TPS){
+            m_tickRate = tickRate;
+            m_head = 0;
+            m_size = 0;
+            m_gap = 1;
+        }
+
+        [[nodiscard]] size_t size() const{
+            return m_size;
+        }
+
+        [[nodiscard]] const Snapshot &newest() const{
+            return at(m_size - 1);
+        }
+    private:
+        [[nodiscard]] const Snapshot &at(size_t i) const{
+            return m_snapshots[(m_head + i) % m_snapshots.size()];
+        }
+
+        double m_delay;
+        int m_tickRate = TPS;
+        double m_offset = 0;
+        double m_gap = 1; // Ticks between snapshots, averaged
+        std::vector<Snapshot> m_snapshots;
+        size_t m_head = 0;
+        size_t m_size = 0;
+    };
+}
+
+#endif //MULTIPONG_SNAPSHOTBUFFER_HPP
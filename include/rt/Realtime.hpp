@@ -0,0 +1,126 @@
+#ifndef MULTIPONG_REALTIME_HPP
+#define MULTIPONG_REALTIME_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <alloca.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace rt {
+    class RealtimeException : public std::exception {
+    public:
+        RealtimeException(const char *what, int error) : m_what(std::string(what) + ": " + std::strerror(error)){
+
+        }
+
+        [[nodiscard]] const char *what() const noexcept override{
+            return m_what.c_str();
+        }
+    private:
+        std::string m_what;
+    };
+
+    struct Profile {
+        int tickCpu = -1;
+        int ioCpu = -1;
+        int fifoPriority = 0; // 0 keeps the default scheduler
+        bool lockMemory = false;
+        int busyPoll = 0; // Microseconds, 0 leaves SO_BUSY_POLL alone
+        std::chrono::nanoseconds spin{0}; // How long before a deadline the tick thread stops sleeping and spins
+    };
+
+    inline void pinThread(pthread_t thread, int cpu){
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        int res = pthread_setaffinity_np(thread, sizeof(set), &set);
+        if (res != 0) throw RealtimeException("pthread_setaffinity_np", res);
+    }
+
+    // Any core but cpu, for a thread that inherited a pin to it
+    inline void avoidCpu(pthread_t thread, int cpu){
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        long count = sysconf(_SC_NPROCESSORS_CONF);
+        for (int i = 0; i < count && i < CPU_SETSIZE; i++) if (i != cpu) CPU_SET(i, &set);
+        int res = pthread_setaffinity_np(thread, sizeof(set), &set);
+        if (res != 0) throw RealtimeException("pthread_setaffinity_np", res);
+    }
+
+    inline void setFifo(pthread_t thread, int priority){
+        sched_param param{};
+        param.sched_priority = priority;
+        int res = pthread_setschedparam(thread, SCHED_FIFO, &param);
+        if (res != 0) throw RealtimeException("pthread_setschedparam", res);
+    }
+
+    // Back to the default scheduler, for a thread that inherited SCHED_FIFO
+    inline void setOther(pthread_t thread){
+        sched_param param{};
+        int res = pthread_setschedparam(thread, SCHED_OTHER, &param);
+        if (res != 0) throw RealtimeException("pthread_setschedparam", res);
+    }
+
+    // Locks every current and future page and keeps the heap from giving memory back, then touches a block of heap and
+    // stack so the first ticks don't page fault on memory that was only reserved
+    inline void lockMemory(size_t heapBytes = 64 << 20, size_t stackBytes = 512 << 10){
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) == -1) throw RealtimeException("mlockall", errno);
+        mallopt(M_TRIM_THRESHOLD, -1);
+        mallopt(M_MMAP_MAX, 0);
+        std::vector<char> heap(heapBytes);
+        long page = sysconf(_SC_PAGESIZE);
+        for (size_t i = 0; i < heap.size(); i += page) ((volatile char *)heap.data())[i] = 1;
+        auto *stack = (volatile char *)alloca(stackBytes);
+        for (size_t i = 0; i < stackBytes; i += page) stack[i] = 1;
+    }
+
+    inline void busyPoll(int fd, int microseconds){
+        if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &microseconds, sizeof(microseconds)) == -1)
+            throw RealtimeException("setsockopt(SO_BUSY_POLL)", errno);
+    }
+
+    // Sleeps on an absolute deadline so oversleeping one tick doesn't push every following tick back,
+    // the last spin nanoseconds are burned in a loop since waking up from a sleep is where the jitter comes from
+    inline void waitUntil(std::chrono::steady_clock::time_point deadline, std::chrono::nanoseconds spin){
+        auto wake = deadline - spin;
+        if (std::chrono::steady_clock::now() < wake){
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(wake.time_since_epoch()).count();
+            timespec ts{(time_t)(ns / 1000000000), (long)(ns % 1000000000)};
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR);
+        }
+        while (std::chrono::steady_clock::now() < deadline);
+    }
+
+    struct JitterReport {
+        size_t samples;
+        std::chrono::nanoseconds p50, p99, p999, max;
+    };
+
+    // Runs an empty tick loop on the calling thread and measures how late every tick starts
+    inline JitterReport measureJitter(std::chrono::nanoseconds period, std::chrono::nanoseconds spin, std::chrono::seconds duration){
+        std::vector<std::chrono::nanoseconds> lateness;
+        lateness.reserve(duration / period + 1);
+        auto deadline = std::chrono::steady_clock::now() + period;
+        auto end = deadline + duration;
+        while (deadline < end){
+            waitUntil(deadline, spin);
+            lateness.push_back(std::chrono::steady_clock::now() - deadline);
+            deadline += period;
+        }
+        std::sort(lateness.begin(), lateness.end());
+        auto percentile = [&lateness](double p){ return lateness[std::min(lateness.size() - 1, (size_t)(lateness.size() * p))]; };
+        return {lateness.size(), percentile(.5), percentile(.99), percentile(.999), lateness.back()};
+    }
+}
+
+#endif //MULTIPONG_REALTIME_HPP
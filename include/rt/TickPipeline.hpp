@@ -0,0 +1,136 @@
+#ifndef MULTIPONG_TICKPIPELINE_HPP
+#define MULTIPONG_TICKPIPELINE_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+
+namespace rt {
+    struct StageTimes {
+        std::chrono::nanoseconds simulate{0}; // Tick start to publish
+        std::chrono::nanoseconds send{0}; // The send stage itself
+        std::chrono::nanoseconds stalled{0}; // Tick thread blocked on a send stage that was still busy
+        unsigned int ticks = 0;
+    };
+
+    // Splits a tick in two: the tick thread simulates and publishes an immutable snapshot, the send stage encodes and
+    // sends it. Threaded, the stage runs on its own thread while the tick thread already works on the next tick. Only
+    // one snapshot is ever in flight, publishing the next waits for the previous one to be out, so clients see the state
+    // at most one tick later than without the pipeline. Not threaded, publish() just runs the stage.
+    // An exception thrown by the stage comes out of the publish() or drain() that follows it, on the tick thread, and
+    // the pipeline is idle when it does.
+    template<class Snapshot>
+    class TickPipeline {
+    public:
+        using Stage = std::function<void(const Snapshot &)>;
+
+        TickPipeline(Stage stage, bool threaded) : m_stage(std::move(stage)){
+            if (threaded) m_thread = std::thread([this]{ run(); });
+        }
+
+        TickPipeline(const TickPipeline &) = delete;
+        TickPipeline &operator=(const TickPipeline &) = delete;
+
+        ~TickPipeline(){
+            if (!m_thread.joinable()) return;
+            {
+                std::lock_guard lock(m_mutex);
+                m_stopping = true;
+            }
+            m_changed.notify_all();
+            m_thread.join();
+        }
+
+        void startTick(){
+            m_tickStart = std::chrono::steady_clock::now();
+        }
+
+        void publish(Snapshot snapshot){
+            auto published = std::chrono::steady_clock::now();
+            if (!m_thread.joinable()) {
+                m_times.simulate += published - m_tickStart;
+                m_times.ticks++;
+                m_stage(snapshot);
+                m_times.send += std::chrono::steady_clock::now() - published;
+                return;
+            }
+            std::unique_lock lock(m_mutex);
+            m_times.simulate += published - m_tickStart;
+            m_times.ticks++;
+            waitIdle(lock);
+            m_times.stalled += std::chrono::steady_clock::now() - published;
+            m_pending.emplace(std::move(snapshot));
+            lock.unlock();
+            m_changed.notify_all();
+        }
+
+        // Waits for the send stage to finish, anything else that writes to the connections has to call this first
+        void drain(){
+            if (!m_thread.joinable()) return;
+            std::unique_lock lock(m_mutex);
+            waitIdle(lock);
+        }
+
+        // Totals since the last call
+        StageTimes takeTimes(){
+            std::lock_guard lock(m_mutex);
+            return std::exchange(m_times, {});
+        }
+
+        [[nodiscard]] bool threaded() const{
+            return m_thread.joinable();
+        }
+
+        [[nodiscard]] std::thread::native_handle_type nativeHandle(){
+            return m_thread.native_handle();
+        }
+    private:
+        void waitIdle(std::unique_lock<std::mutex> &lock){
+            m_changed.wait(lock, [this]{ return !m_pending && !m_busy; });
+            if (m_failure) std::rethrow_exception(std::exchange(m_failure, nullptr));
+        }
+
+        void run(){
+            std::unique_lock lock(m_mutex);
+            while (true) {
+                m_changed.wait(lock, [this]{ return m_pending || m_stopping; });
+                if (m_stopping) return;
+                Snapshot snapshot = std::move(*m_pending);
+                m_pending.reset();
+                m_busy = true;
+                lock.unlock();
+                auto start = std::chrono::steady_clock::now();
+                std::exception_ptr failure;
+                try {
+                    m_stage(snapshot);
+                } catch (...) {
+                    failure = std::current_exception();
+                }
+                auto end = std::chrono::steady_clock::now();
+                lock.lock();
+                m_times.send += end - start;
+                m_failure = failure;
+                m_busy = false;
+                m_changed.notify_all();
+            }
+        }
+
+        Stage m_stage;
+        std::chrono::steady_clock::time_point m_tickStart;
+        std::mutex m_mutex;
+        std::condition_variable m_changed;
+        std::optional<Snapshot> m_pending;
+        bool m_busy = false;
+        bool m_stopping = false;
+        std::exception_ptr m_failure;
+        StageTimes m_times;
+        std::thread m_thread;
+    };
+}
+
+#endif //MULTIPONG_TICKPIPELINE_HPP
@@ -0,0 +1,180 @@
+#ifndef MULTIPONG_TIMERWHEEL_HPP
+#define MULTIPONG_TIMERWHEEL_HPP
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <optional>
+
+namespace rt {
+    class TimerWheel;
+
+    // Lives in whatever it schedules, the wheel only links it in. An unscheduled timer costs the wheel nothing.
+    class Timer {
+    public:
+        explicit Timer(std::function<void()> callback) : m_callback(std::move(callback)){
+
+        }
+
+        Timer(const Timer &) = delete;
+        Timer &operator=(const Timer &) = delete;
+
+        inline ~Timer();
+
+        [[nodiscard]] bool scheduled() const{
+            return m_wheel != nullptr;
+        }
+    private:
+        friend class TimerWheel;
+
+        std::function<void()> m_callback;
+        TimerWheel *m_wheel = nullptr;
+        Timer *m_previous = nullptr, *m_next = nullptr;
+        uint64_t m_expiry = 0; // In wheel ticks
+        unsigned int m_level = 0, m_slot = 0;
+    };
+
+    // Hierarchical timing wheel: levels of 64 slots, each slot of a level spanning a whole turn of the level below.
+    // Scheduling and cancelling are O(1), a timer moves down a level each time its slot comes up until it fires from
+    // the lowest one, and finding the next deadline is a bit scan per level. Timers fire in resolution sized steps, never
+    // before their deadline.
+    class TimerWheel {
+    public:
+        static constexpr unsigned int levels = 4;
+        static constexpr unsigned int slotBits = 6;
+        static constexpr unsigned int slots = 1 << slotBits;
+        static constexpr uint64_t range = (uint64_t)1 << (slotBits * levels); // Farther out timers wait in the top level
+
+        explicit TimerWheel(std::chrono::nanoseconds resolution, std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now())
+            : m_resolution(resolution), m_start(start){
+
+        }
+
+        TimerWheel(const TimerWheel &) = delete;
+        TimerWheel &operator=(const TimerWheel &) = delete;
+
+        ~TimerWheel(){
+            for (auto &level : m_slots)
+                for (Timer *&head : level)
+                    while (head != nullptr) unlink(*head);
+        }
+
+        // Reschedules the timer if it already was, a deadline in the past fires on the next advance
+        void schedule(Timer &timer, std::chrono::steady_clock::time_point deadline){
+            if (timer.scheduled()) unlink(timer);
+            auto offset = deadline - m_start;
+            timer.m_expiry = offset.count() <= 0 ? 0 : (uint64_t)((offset + m_resolution - std::chrono::nanoseconds(1)) / m_resolution);
+            link(timer, m_now + 1);
+        }
+
+        void cancel(Timer &timer){
+            if (timer.scheduled()) unlink(timer);
+        }
+
+        // Fires every timer due by now in deadline order, returns how many. Callbacks may schedule and cancel timers.
+        size_t advance(std::chrono::steady_clock::time_point now){
+            if (now < m_start) return 0;
+            uint64_t target = (uint64_t)((now - m_start) / m_resolution);
+            size_t fired = 0;
+            while (m_now < target) {
+                m_now++;
+                for (unsigned int level = 1; level < levels && (m_now & (((uint64_t)1 << (slotBits * level)) - 1)) == 0; level++)
+                    cascade(level);
+                Timer *&head = m_slots[0][m_now & (slots - 1)];
+                while (head != nullptr) {
+                    Timer &timer = *head;
+                    unlink(timer);
+                    timer.m_callback();
+                    fired++;
+                }
+                // Nothing left anywhere, skip straight to the target instead of walking every empty slot
+                if (m_count == 0) m_now = target;
+            }
+            return fired;
+        }
+
+        // When advance() next has something to do, a timer or a slot moving down a level
+        [[nodiscard]] std::optional<std::chrono::steady_clock::time_point> nextDeadline() const{
+            std::optional<uint64_t> next;
+            auto earliest = [&next](uint64_t tick){
+                if (!next || tick < *next) next = tick;
+            };
+            if (m_occupied[0] != 0)
+                earliest(m_now + 1 + std::countr_zero(std::rotr(m_occupied[0], (int)((m_now + 1) & (slots - 1)))));
+            for (unsigned int level = 1; level < levels; level++) {
+                if (m_occupied[level] == 0) continue;
+                unsigned int shift = slotBits * level;
+                uint64_t boundary = ((m_now >> shift) + 1) << shift;
+                earliest(boundary + ((uint64_t)std::countr_zero(std::rotr(m_occupied[level], (int)((boundary >> shift) & (slots - 1)))) << shift));
+            }
+            if (!next) return std::nullopt;
+            return m_start + m_resolution * (long long)*next;
+        }
+
+        [[nodiscard]] size_t size() const{
+            return m_count;
+        }
+
+        [[nodiscard]] std::chrono::nanoseconds resolution() const{
+            return m_resolution;
+        }
+    private:
+        friend class Timer;
+
+        // earliest is the first tick the timer can still fire on. Cascading that is the current tick, its level 0 slot
+        // fires right after.
+        void link(Timer &timer, uint64_t earliest){
+            uint64_t delta = std::max(timer.m_expiry, earliest) - m_now;
+            uint64_t placed = m_now + std::min(delta, range - 1);
+            unsigned int level = 0;
+            while (level + 1 < levels && delta >= (uint64_t)1 << (slotBits * (level + 1))) level++;
+            unsigned int slot = (unsigned int)(placed >> (slotBits * level)) & (slots - 1);
+            Timer *&head = m_slots[level][slot];
+            timer.m_wheel = this;
+            timer.m_level = level;
+            timer.m_slot = slot;
+            timer.m_previous = nullptr;
+            timer.m_next = head;
+            if (head != nullptr) head->m_previous = &timer;
+            head = &timer;
+            m_occupied[level] |= (uint64_t)1 << slot;
+            m_count++;
+        }
+
+        void unlink(Timer &timer){
+            Timer *&head = m_slots[timer.m_level][timer.m_slot];
+            if (timer.m_previous != nullptr) timer.m_previous->m_next = timer.m_next;
+            else head = timer.m_next;
+            if (timer.m_next != nullptr) timer.m_next->m_previous = timer.m_previous;
+            if (head == nullptr) m_occupied[timer.m_level] &= ~((uint64_t)1 << timer.m_slot);
+            timer.m_wheel = nullptr;
+            timer.m_previous = timer.m_next = nullptr;
+            m_count--;
+        }
+
+        // The slot of this level that just came up gets spread over the levels below
+        void cascade(unsigned int level){
+            Timer *&head = m_slots[level][(m_now >> (slotBits * level)) & (slots - 1)];
+            while (head != nullptr) {
+                Timer &timer = *head;
+                unlink(timer);
+                link(timer, m_now);
+            }
+        }
+
+        std::chrono::nanoseconds m_resolution;
+        std::chrono::steady_clock::time_point m_start;
+        uint64_t m_now = 0; // Every timer up to this tick has fired
+        Timer *m_slots[levels][slots]{};
+        uint64_t m_occupied[levels]{};
+        size_t m_count = 0;
+    };
+
+    Timer::~Timer(){
+        if (m_wheel != nullptr) m_wheel->cancel(*this);
+    }
+}
+
+#endif //MULTIPONG_TIMERWHEEL_HPP
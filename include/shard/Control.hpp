@@ -0,0 +1,142 @@
+#ifndef MULTIPONG_CONTROL_HPP
+#define MULTIPONG_CONTROL_HPP
+
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "../sock/Socket.hpp"
+
+// The router and its shards talk over one local seqpacket socket per shard, so every send arrives as one message. The
+// router sends players, one byte each with the client's fd attached, and the shard sends ShardLoad reports back.
+namespace shard {
+    class ControlException : public std::exception {
+    public:
+        ControlException(const char *what, int error) : m_what(what), m_error(error){
+
+        }
+
+        [[nodiscard]] const char *what() const noexcept override{
+            return m_what;
+        }
+
+        [[nodiscard]] int error() const noexcept{
+            return m_error;
+        }
+    private:
+        const char *m_what;
+        int m_error;
+    };
+
+    struct __attribute__((packed)) ShardLoad {
+        unsigned int matches;   // Matches being played right now
+        unsigned int players;   // Connected players, in a match or waiting for one
+        unsigned int seats;     // Players the shard can hold at once
+        unsigned int received;  // Clients received from the router since the shard started
+        float overrunRate;      // Share of the last report's ticks that missed their deadline
+    };
+
+    inline sockaddr_un controlAddress(const std::string &path){
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path)) throw ControlException("control socket path too long", ENAMETOOLONG);
+        std::memcpy(addr.sun_path, path.c_str(), path.size());
+        return addr;
+    }
+
+    // Router side, a stale socket file from a previous run is replaced
+    inline sock::Socket listenControl(const std::string &path){
+        sockaddr_un addr = controlAddress(path);
+        sock::Socket socket(AF_UNIX, SOCK_SEQPACKET, 0);
+        ::unlink(path.c_str());
+        socket.bind((const sockaddr *)&addr, sizeof(addr));
+        socket.listen(16);
+        return socket;
+    }
+
+    // Shard side
+    inline sock::Socket connectControl(const std::string &path){
+        sockaddr_un addr = controlAddress(path);
+        sock::Socket socket(AF_UNIX, SOCK_SEQPACKET, 0);
+        socket.connect((const sockaddr *)&addr, sizeof(addr));
+        return socket;
+    }
+
+    // The shard gets its own copy of the fd, the router closes its copy right after. Never blocks, false when the
+    // shard isn't reading its control socket and the handoff has to go somewhere else.
+    inline bool sendClient(const sock::Socket &control, const sock::Socket &client){
+        char tag = 'C';
+        iovec iov{&tag, 1};
+        alignas(cmsghdr) char space[CMSG_SPACE(sizeof(int))]{};
+        msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = space;
+        msg.msg_controllen = sizeof(space);
+        cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        int fd = client.fd();
+        std::memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+        if (::sendmsg(control.fd(), &msg, MSG_DONTWAIT | MSG_NOSIGNAL) != -1) return true;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return false;
+        throw ControlException("sendmsg", errno);
+    }
+
+    // Blocks until the router sends a player, throws once the router is gone
+    inline sock::Socket receiveClient(const sock::Socket &control){
+        char tag;
+        iovec iov{&tag, 1};
+        alignas(cmsghdr) char space[CMSG_SPACE(sizeof(int))]{};
+        msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = space;
+        msg.msg_controllen = sizeof(space);
+        ssize_t read = ::recvmsg(control.fd(), &msg, MSG_CMSG_CLOEXEC);
+        if (read == -1) throw ControlException("recvmsg", errno);
+        if (read == 0) throw ControlException("router closed the control socket", 0);
+        cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg == nullptr || cmsg->cmsg_type != SCM_RIGHTS) throw ControlException("no fd attached", EPROTO);
+        int fd;
+        std::memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+        sock::Socket client(fd);
+        return client;
+    }
+
+    // Counts missed tick deadlines and sends a ShardLoad to the router every reportInterval
+    class Reporter {
+    public:
+        static constexpr std::chrono::milliseconds reportInterval{250};
+
+        explicit Reporter(sock::Socket control) : m_control(control){
+
+        }
+
+        void received(){
+            m_received++;
+        }
+
+        void tick(bool overran, unsigned int matches, unsigned int players, unsigned int seats){
+            m_ticks++;
+            if (overran) m_overruns++;
+            auto now = std::chrono::steady_clock::now();
+            if (now - m_lastReport < reportInterval) return;
+            ShardLoad load{matches, players, seats, m_received, (float)m_overruns / (float)m_ticks};
+            // The router reads reports all the time, if its buffer is full anyway this one can be skipped
+            if (::send(m_control.fd(), &load, sizeof(load), MSG_DONTWAIT | MSG_NOSIGNAL) == -1 && errno != EAGAIN)
+                throw ControlException("send", errno);
+            m_lastReport = now;
+            m_ticks = m_overruns = 0;
+        }
+    private:
+        sock::Socket m_control;
+        std::chrono::steady_clock::time_point m_lastReport{};
+        unsigned int m_ticks = 0, m_overruns = 0, m_received = 0;
+    };
+}
+
+#endif //MULTIPONG_CONTROL_HPP
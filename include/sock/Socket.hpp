@@ -2,11 +2,14 @@
 #define TESTS_SOCKET_HPP
 
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <algorithm>
 #include <vector>
 #include <unistd.h>
 #include <stdexcept>
+#include <cerrno>
 
 namespace sock {
     typedef int socket_t;
@@ -86,15 +89,21 @@ namespace sock {
 
     class AcceptException : public SocketException {
     public:
-        explicit AcceptException(const char *what, socket_t socket) : m_what(what), SocketException(socket){
+        AcceptException(const char *what, socket_t socket, int error) : m_what(what), m_error(error), SocketException(socket){
 
         }
 
         [[nodiscard]] const char *what() const noexcept override{
             return m_what;
         }
+
+        // errno of the failed accept, anything run while unwinding may have changed the global one
+        [[nodiscard]] int error() const noexcept{
+            return m_error;
+        }
     private:
         const char *m_what;
+        int m_error;
     };
 
     class DisconnectionException : public SocketException{
@@ -253,7 +262,7 @@ namespace sock {
 
         Socket accept(struct sockaddr *addr, socklen_t *len){
             Socket socket{::accept(m_fd, addr, len)};
-            if (socket.fd() == -1) throw AcceptException("accept", fd());
+            if (socket.fd() == -1) throw AcceptException("accept", fd(), errno);
             socket.m_connected = true;
             return socket;
         }
@@ -287,6 +296,18 @@ namespace sock {
             return array;
         }
 
+        // Never blocks, returns 0 when nothing is waiting
+        len_t tryRecv(void *data, len_t len, int flags = 0){
+            ssize_t res = ::recv(m_fd, data, len, flags | MSG_DONTWAIT);
+            if (res == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+            if (res == -1) throw ReadException("recv", fd());
+            if (res == 0 && len != 0) {
+                m_connected = false;
+                throw DisconnectionException(fd());
+            }
+            return res;
+        }
+
         len_t send(const void *data, len_t len, int flags = 0){
             len_t res = ::send(m_fd, data, len, flags);
             if (res == -1) throw WriteException("send", fd());
@@ -298,6 +319,17 @@ namespace sock {
             return sent;
         }
 
+        // Never blocks, returns 0 instead of throwing when the socket buffer is full
+        len_t trySend(const iovec *iov, size_t count, int flags = 0){
+            msghdr msg{};
+            msg.msg_iov = const_cast<iovec *>(iov);
+            msg.msg_iovlen = count;
+            ssize_t res = ::sendmsg(m_fd, &msg, flags | MSG_DONTWAIT);
+            if (res == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+            if (res == -1) throw WriteException("sendmsg", fd());
+            return res;
+        }
+
         [[nodiscard]] socket_t fd() const noexcept{
             return m_fd;
         }
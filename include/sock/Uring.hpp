@@ -0,0 +1,184 @@
+#ifndef MULTIPONG_URING_HPP
+#define MULTIPONG_URING_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace sock {
+    class UringException : public std::exception {
+    public:
+        UringException(const char *what, int error) : m_what(what), m_error(error){
+
+        }
+
+        [[nodiscard]] const char *what() const noexcept override{
+            return m_what;
+        }
+
+        [[nodiscard]] int error() const noexcept{
+            return m_error;
+        }
+    private:
+        const char *m_what;
+        int m_error;
+    };
+
+    // Bare io_uring instance talking to the kernel through the raw syscalls, with one ring of provided buffers
+    // (buffer group 0) for multishot receives to pick from
+    class Uring {
+    public:
+        static constexpr unsigned short bufferGroup = 0;
+
+        Uring(unsigned entries, unsigned bufferCount, unsigned bufferSize) : m_bufferCount(bufferCount), m_bufferSize(bufferSize){
+            if (bufferCount == 0 || (bufferCount & (bufferCount - 1)) != 0 || bufferCount > 32768) throw std::invalid_argument("Uring");
+            io_uring_params params{};
+            m_fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+            if (m_fd == -1) throw UringException("io_uring_setup", errno);
+            try {
+                map(params);
+                registerBuffers();
+            } catch (...) {
+                release();
+                throw;
+            }
+        }
+
+        Uring(const Uring &) = delete;
+        Uring &operator=(const Uring &) = delete;
+
+        ~Uring(){
+            release();
+        }
+
+        // nullptr when the submission queue is full
+        io_uring_sqe *sqe(){
+            unsigned head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+            if (m_sqeTail - head >= *m_sqEntries) return nullptr;
+            unsigned index = m_sqeTail & *m_sqMask;
+            io_uring_sqe *sqe = &m_sqes[index];
+            std::memset(sqe, 0, sizeof(*sqe));
+            m_sqArray[index] = index;
+            m_sqeTail++;
+            return sqe;
+        }
+
+        [[nodiscard]] unsigned pending() const{
+            return m_sqeTail - *m_sqTail;
+        }
+
+        // One io_uring_enter for everything prepared since the last call, waiting for at least minComplete completions
+        void submit(unsigned minComplete = 0){
+            unsigned count = pending();
+            __atomic_store_n(m_sqTail, m_sqeTail, __ATOMIC_RELEASE);
+            if (count == 0 && minComplete == 0) return;
+            unsigned flags = minComplete != 0 ? IORING_ENTER_GETEVENTS : 0;
+            while (syscall(__NR_io_uring_enter, m_fd, count, minComplete, flags, nullptr, 0) == -1){
+                if (errno != EINTR) throw UringException("io_uring_enter", errno);
+            }
+        }
+
+        // Completions only need the shared ring, reaping them costs no syscall
+        template<class Handler>
+        unsigned reap(Handler &&handler){
+            unsigned head = *m_cqHead, count = 0;
+            while (head != __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE)){
+                handler(m_cqes[head & *m_cqMask]);
+                head++;
+                count++;
+            }
+            __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+            return count;
+        }
+
+        [[nodiscard]] const char *buffer(unsigned id) const{
+            return m_buffers + (size_t)id * m_bufferSize;
+        }
+
+        // Gives a buffer picked by a receive back to the kernel
+        void recycle(unsigned id){
+            unsigned short tail = m_bufferRing->tail;
+            // Not bufs[], in C++ the header's flexible array member ends up behind an empty struct instead of at offset 0
+            io_uring_buf &buf = ((io_uring_buf *)m_bufferRing)[tail & (m_bufferCount - 1)];
+            buf.addr = (unsigned long long)buffer(id);
+            buf.len = m_bufferSize;
+            buf.bid = id;
+            __atomic_store_n(&m_bufferRing->tail, (unsigned short)(tail + 1), __ATOMIC_RELEASE);
+        }
+
+        [[nodiscard]] int fd() const noexcept{
+            return m_fd;
+        }
+    private:
+        void map(const io_uring_params &params){
+            m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            if (params.features & IORING_FEAT_SINGLE_MMAP) m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+            m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+            if (m_sqRing == MAP_FAILED) throw UringException("mmap", errno);
+            if (params.features & IORING_FEAT_SINGLE_MMAP) m_cqRing = m_sqRing;
+            else {
+                m_cqRing = mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+                if (m_cqRing == MAP_FAILED) throw UringException("mmap", errno);
+            }
+            m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+            m_sqes = (io_uring_sqe *)mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+            if (m_sqes == MAP_FAILED) throw UringException("mmap", errno);
+            auto *sq = (char *)m_sqRing, *cq = (char *)m_cqRing;
+            m_sqHead = (unsigned *)(sq + params.sq_off.head);
+            m_sqTail = (unsigned *)(sq + params.sq_off.tail);
+            m_sqMask = (unsigned *)(sq + params.sq_off.ring_mask);
+            m_sqEntries = (unsigned *)(sq + params.sq_off.ring_entries);
+            m_sqArray = (unsigned *)(sq + params.sq_off.array);
+            m_cqHead = (unsigned *)(cq + params.cq_off.head);
+            m_cqTail = (unsigned *)(cq + params.cq_off.tail);
+            m_cqMask = (unsigned *)(cq + params.cq_off.ring_mask);
+            m_cqes = (io_uring_cqe *)(cq + params.cq_off.cqes);
+            m_sqeTail = *m_sqTail;
+        }
+
+        void registerBuffers(){
+            m_bufferRingSize = m_bufferCount * sizeof(io_uring_buf);
+            m_bufferRing = (io_uring_buf_ring *)mmap(nullptr, m_bufferRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (m_bufferRing == MAP_FAILED) throw UringException("mmap", errno);
+            m_buffersSize = (size_t)m_bufferCount * m_bufferSize;
+            m_buffers = (char *)mmap(nullptr, m_buffersSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (m_buffers == MAP_FAILED) throw UringException("mmap", errno);
+            io_uring_buf_reg reg{};
+            reg.ring_addr = (unsigned long long)m_bufferRing;
+            reg.ring_entries = m_bufferCount;
+            reg.bgid = bufferGroup;
+            // Provided buffer rings arrived in 5.19, a kernel without them can't do what this backend is for
+            if (syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) throw UringException("io_uring_register", errno);
+            for (unsigned i = 0; i < m_bufferCount; i++) recycle(i);
+        }
+
+        void release(){
+            if (m_buffers != nullptr && m_buffers != MAP_FAILED) munmap(m_buffers, m_buffersSize);
+            if (m_bufferRing != nullptr && m_bufferRing != MAP_FAILED) munmap(m_bufferRing, m_bufferRingSize);
+            if (m_sqes != nullptr && m_sqes != MAP_FAILED) munmap(m_sqes, m_sqesSize);
+            if (m_cqRing != nullptr && m_cqRing != MAP_FAILED && m_cqRing != m_sqRing) munmap(m_cqRing, m_cqRingSize);
+            if (m_sqRing != nullptr && m_sqRing != MAP_FAILED) munmap(m_sqRing, m_sqRingSize);
+            ::close(m_fd);
+        }
+
+        int m_fd;
+        unsigned m_bufferCount, m_bufferSize;
+        void *m_sqRing = nullptr, *m_cqRing = nullptr;
+        size_t m_sqRingSize = 0, m_cqRingSize = 0, m_sqesSize = 0, m_bufferRingSize = 0, m_buffersSize = 0;
+        io_uring_sqe *m_sqes = nullptr;
+        unsigned *m_sqHead{}, *m_sqTail{}, *m_sqMask{}, *m_sqEntries{}, *m_sqArray{};
+        unsigned *m_cqHead{}, *m_cqTail{}, *m_cqMask{};
+        io_uring_cqe *m_cqes{};
+        unsigned m_sqeTail = 0;
+        io_uring_buf_ring *m_bufferRing = nullptr;
+        char *m_buffers = nullptr;
+    };
+}
+
+#endif //MULTIPONG_URING_HPP
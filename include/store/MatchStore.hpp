@@ -0,0 +1,250 @@
+#ifndef MULTIPONG_MATCHSTORE_HPP
+#define MULTIPONG_MATCHSTORE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../lockfree/SpscRing.hpp"
+
+namespace store {
+    class StoreException : public std::exception {
+    public:
+        explicit StoreException(const char *what) : m_what(what){
+
+        }
+
+        [[nodiscard]] const char *what() const noexcept override{
+            return m_what;
+        }
+    private:
+        const char *m_what;
+    };
+
+    // On-disk layout of one finished match, the log is nothing but these back to back
+    struct __attribute__((packed)) MatchRecord {
+        static constexpr unsigned int recordMagic = 0x3152504D; // "MPR1"
+
+        unsigned int magic;
+        long long endTime; // Unix time in nanoseconds
+        long long duration; // Nanoseconds
+        unsigned long long ticks;
+        int scores[2];
+        char players[2][48];
+        unsigned int checksum;
+
+        [[nodiscard]] unsigned int computeChecksum() const{
+            // FNV-1a over everything but the checksum itself, enough to spot a record torn by a crash
+            unsigned int hash = 2166136261u;
+            const auto *bytes = (const unsigned char *)this;
+            for (size_t i = 0; i < offsetof(MatchRecord, checksum); i++){
+                hash ^= bytes[i];
+                hash *= 16777619u;
+            }
+            return hash;
+        }
+
+        [[nodiscard]] bool valid() const{
+            return magic == recordMagic && checksum == computeChecksum();
+        }
+    };
+
+    struct PlayerStats {
+        std::string name;
+        unsigned int wins = 0;
+        unsigned int losses = 0;
+        unsigned long long points = 0;
+        std::vector<size_t> matches;
+    };
+
+    class MatchIndex {
+        struct RankOrder {
+            bool operator()(const PlayerStats *a, const PlayerStats *b) const{
+                if (a->wins != b->wins) return a->wins > b->wins;
+                if (a->points != b->points) return a->points > b->points;
+                return a->name < b->name;
+            }
+        };
+    public:
+        void add(const MatchRecord &record){
+            std::unique_lock lock(m_mutex);
+            size_t index = m_matches.size();
+            m_matches.push_back(record);
+            for (int i = 0; i < 2; i++){
+                std::string name(record.players[i], strnlen(record.players[i], sizeof(record.players[i])));
+                PlayerStats &stats = m_players[name];
+                stats.name = name;
+                // The ranking is keyed on the stats, take the player out while they change
+                m_ranking.erase(&stats);
+                if (record.scores[i] > record.scores[1 - i]) stats.wins++;
+                else if (record.scores[i] < record.scores[1 - i]) stats.losses++;
+                stats.points += record.scores[i];
+                if (stats.matches.empty() || stats.matches.back() != index) stats.matches.push_back(index);
+                m_ranking.insert(&stats);
+            }
+        }
+
+        [[nodiscard]] std::vector<PlayerStats> leaderboard(size_t count) const{
+            std::shared_lock lock(m_mutex);
+            std::vector<PlayerStats> top;
+            for (auto it = m_ranking.begin(); it != m_ranking.end() && top.size() < count; ++it){
+                top.push_back(**it);
+                top.back().matches.clear();
+            }
+            return top;
+        }
+
+        // Most recent first
+        [[nodiscard]] std::vector<MatchRecord> history(const std::string &player, size_t count) const{
+            std::shared_lock lock(m_mutex);
+            std::vector<MatchRecord> matches;
+            auto it = m_players.find(player);
+            if (it == m_players.end()) return matches;
+            const std::vector<size_t> &indices = it->second.matches;
+            for (auto index = indices.rbegin(); index != indices.rend() && matches.size() < count; ++index)
+                matches.push_back(m_matches[*index]);
+            return matches;
+        }
+
+        [[nodiscard]] size_t size() const{
+            std::shared_lock lock(m_mutex);
+            return m_matches.size();
+        }
+    private:
+        mutable std::shared_mutex m_mutex;
+        std::vector<MatchRecord> m_matches;
+        std::unordered_map<std::string, PlayerStats> m_players;
+        std::set<const PlayerStats *, RankOrder> m_ranking;
+    };
+
+    // Append-only match log. submit() only pushes into a ring, a background thread appends whatever piled up
+    // and fsyncs once per batch, so a tick never waits on the disk.
+    class MatchStore {
+    public:
+        static constexpr size_t queueCapacity = 256;
+        static constexpr std::chrono::milliseconds flushInterval{100};
+
+        explicit MatchStore(const std::string &path) : m_queue(queueCapacity){
+            m_fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            if (m_fd == -1) throw StoreException("open");
+            load();
+            m_thread = std::thread([this]{ run(); });
+        }
+
+        MatchStore(const MatchStore &) = delete;
+        MatchStore &operator=(const MatchStore &) = delete;
+
+        ~MatchStore(){
+            m_running.store(false, std::memory_order_relaxed);
+            m_thread.join();
+            ::close(m_fd);
+        }
+
+        // Single producer, meant to be called from the tick thread
+        bool submit(const MatchRecord &record){
+            MatchRecord sealed = record;
+            sealed.magic = MatchRecord::recordMagic;
+            sealed.checksum = sealed.computeChecksum();
+            if (m_queue.tryPush(sealed)) return true;
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        [[nodiscard]] const MatchIndex &index() const{
+            return m_index;
+        }
+
+        [[nodiscard]] unsigned long long dropped() const{
+            return m_dropped.load(std::memory_order_relaxed);
+        }
+
+        [[nodiscard]] std::thread::native_handle_type nativeHandle(){
+            return m_thread.native_handle();
+        }
+    private:
+        void load(){
+            struct stat st{};
+            if (fstat(m_fd, &st) == -1) throw StoreException("fstat");
+            if (st.st_size == 0) return;
+            void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+            if (map == MAP_FAILED) throw StoreException("mmap");
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            size_t count = st.st_size / sizeof(MatchRecord), valid = 0;
+            for (; valid < count; valid++){
+                MatchRecord record{};
+                std::memcpy(&record, (const char *)map + valid * sizeof(MatchRecord), sizeof(MatchRecord));
+                if (!record.valid()) break;
+                m_index.add(record);
+            }
+            munmap(map, st.st_size);
+            // Whatever follows the last good record was cut short by a crash, drop it so new records stay aligned
+            m_size = valid * sizeof(MatchRecord);
+            if (m_size != (size_t)st.st_size && ftruncate(m_fd, (off_t)m_size) == -1)
+                throw StoreException("ftruncate");
+        }
+
+        void run(){
+            std::vector<MatchRecord> batch;
+            while (true){
+                bool running = m_running.load(std::memory_order_relaxed);
+                MatchRecord record{};
+                while (m_queue.tryPop(record)) batch.push_back(record);
+                if (!batch.empty()){
+                    size_t written = write(batch);
+                    if (written != 0) fdatasync(m_fd);
+                    // Only what is on disk goes into the index, the rest is tried again with the next batch
+                    for (size_t i = 0; i < written; i++) m_index.add(batch[i]);
+                    batch.erase(batch.begin(), batch.begin() + (long)written);
+                    if (batch.size() > queueCapacity){
+                        m_dropped.fetch_add(batch.size() - queueCapacity, std::memory_order_relaxed);
+                        batch.erase(batch.begin(), batch.end() - (long)queueCapacity);
+                    }
+                }
+                if (!running) break;
+                std::this_thread::sleep_for(flushInterval);
+            }
+        }
+
+        // How many records of the batch made it to the file whole. A failed write can leave part of a record behind,
+        // that gets cut off again so the next record still starts where the last good one ended.
+        size_t write(const std::vector<MatchRecord> &batch){
+            if (m_torn){
+                if (ftruncate(m_fd, (off_t)m_size) == -1) return 0;
+                m_torn = false;
+            }
+            const char *data = (const char *)batch.data();
+            size_t size = batch.size() * sizeof(MatchRecord), written = 0;
+            while (written < size){
+                ssize_t res = ::write(m_fd, data + written, size - written);
+                if (res <= 0) break;
+                written += res;
+            }
+            size_t records = written / sizeof(MatchRecord);
+            m_size += records * sizeof(MatchRecord);
+            if (records * sizeof(MatchRecord) != written) m_torn = ftruncate(m_fd, (off_t)m_size) == -1;
+            return records;
+        }
+
+        int m_fd;
+        size_t m_size = 0; // End of the last whole record
+        bool m_torn = false; // A partial record is still at the end, cutting it off failed
+        lockfree::SpscRing<MatchRecord> m_queue;
+        MatchIndex m_index;
+        std::atomic<bool> m_running{true};
+        std::atomic<unsigned long long> m_dropped{0};
+        std::thread m_thread;
+    };
+}
+
+#endif //MULTIPONG_MATCHSTORE_HPP
@@ -0,0 +1,181 @@
+#ifndef MULTIPONG_CONNECTION_HPP
+#define MULTIPONG_CONNECTION_HPP
+
+#include <chrono>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+#include "../sock/Socket.hpp"
+
+namespace tcp {
+    class LagException : public sock::SocketException {
+    public:
+        explicit LagException(sock::socket_t socket) : SocketException(socket){
+
+        }
+
+        [[nodiscard]] const char *what() const noexcept override{
+            return "connection exceeded its lag budget";
+        }
+    };
+
+    // Socket with its own bounded outbound queue, flush() sends what the kernel takes right now and keeps the rest,
+    // so a peer that stops reading only ever fills its own queue. Frames queued under a slot replace the previous
+    // frame of that slot as long as it hasn't started going out, state updates don't pile up behind a slow link.
+    class Connection : public sock::Socket {
+    public:
+        static constexpr size_t defaultMaxQueued = 64 << 10;
+        static constexpr std::chrono::milliseconds defaultLagBudget{500};
+
+        Connection() = default;
+
+        explicit Connection(const sock::Socket &socket) : sock::Socket(socket){
+
+        }
+
+        explicit Connection(sock::Socket &&socket) : sock::Socket(socket){
+
+        }
+
+        Connection(const Connection &) = delete;
+        Connection &operator=(const Connection &) = delete;
+        Connection(Connection &&) = default;
+        Connection &operator=(Connection &&) = default;
+
+        void setLagBudget(std::chrono::milliseconds budget, size_t maxQueued = defaultMaxQueued){
+            m_lagBudget = budget;
+            m_maxQueued = maxQueued;
+        }
+
+        // Kept until it is sent
+        void queue(const void *data, size_t length){
+            push(-1, data, length);
+        }
+
+        // Only the newest frame of each slot is kept
+        void queueLatest(int slot, const void *data, size_t length){
+            auto it = m_slots.find(slot);
+            if (it != m_slots.end()){
+                size_t index = it->second - m_firstSequence;
+                if (index < m_frames.size() && (index != 0 || m_sentOffset == 0)){
+                    Frame &frame = m_frames[index];
+                    m_queued += length - frame.bytes.size();
+                    frame.bytes.assign((const char *)data, (const char *)data + length);
+                    return;
+                }
+            }
+            push(slot, data, length);
+        }
+
+        // Throws LagException once the queue has been backed up for longer than the budget or grew past its limit
+        void flush(){
+            while (!m_frames.empty()){
+                iovec iov[64];
+                size_t count = 0;
+                for (size_t i = 0; i < m_frames.size() && count < 64; i++, count++){
+                    size_t offset = i == 0 ? m_sentOffset : 0;
+                    iov[count] = {m_frames[i].bytes.data() + offset, m_frames[i].bytes.size() - offset};
+                }
+                len_t sent = trySend(iov, count, MSG_NOSIGNAL);
+                if (sent == 0) break;
+                consume(sent);
+            }
+            checkLag(!m_frames.empty());
+        }
+
+        // For backends that send on their own, moves every queued byte into out and forgets about it
+        bool takeQueued(std::vector<char> &out){
+            if (m_frames.empty()) return false;
+            while (!m_frames.empty()){
+                const std::vector<char> &bytes = m_frames.front().bytes;
+                out.insert(out.end(), bytes.begin() + (long)m_sentOffset, bytes.end());
+                consume(bytes.size() - m_sentOffset);
+            }
+            return true;
+        }
+
+        // Gives bytes back that a backend took with takeQueued() but never got out, they go first again
+        void requeueTaken(const char *data, size_t length){
+            if (length == 0) return;
+            m_frames.push_front({std::vector<char>(data, data + length), -1});
+            m_firstSequence--;
+            m_queued += length;
+            m_sent -= length;
+        }
+
+        void checkLag(bool backedUp){
+            if (!backedUp){
+                m_backedUp = false;
+                return;
+            }
+            auto now = std::chrono::steady_clock::now();
+            if (!m_backedUp){
+                m_backedUp = true;
+                m_backedUpSince = now;
+            }
+            if (m_queued > m_maxQueued || now - m_backedUpSince > m_lagBudget) throw LagException(fd());
+        }
+
+        // Bytes received but not parsed yet, filled by whichever backend reads the socket
+        [[nodiscard]] std::vector<char> &inbound(){
+            return m_inbound;
+        }
+
+        [[nodiscard]] size_t queued() const{
+            return m_queued;
+        }
+
+        // Every byte that ever left the queue for the kernel or a backend
+        [[nodiscard]] unsigned long long sent() const{
+            return m_sent;
+        }
+    private:
+        struct Frame {
+            std::vector<char> bytes;
+            int slot;
+        };
+
+        void push(int slot, const void *data, size_t length){
+            if (slot != -1) m_slots[slot] = m_firstSequence + m_frames.size();
+            m_frames.push_back({std::vector<char>((const char *)data, (const char *)data + length), slot});
+            m_queued += length;
+        }
+
+        void consume(size_t sent){
+            m_queued -= sent;
+            m_sent += sent;
+            while (sent != 0){
+                size_t left = m_frames.front().bytes.size() - m_sentOffset;
+                if (sent < left){
+                    m_sentOffset += sent;
+                    break;
+                }
+                sent -= left;
+                pop();
+            }
+        }
+
+        void pop(){
+            Frame &frame = m_frames.front();
+            auto it = m_slots.find(frame.slot);
+            if (it != m_slots.end() && it->second == m_firstSequence) m_slots.erase(it);
+            m_frames.pop_front();
+            m_firstSequence++;
+            m_sentOffset = 0;
+        }
+
+        std::vector<char> m_inbound;
+        std::deque<Frame> m_frames;
+        std::unordered_map<int, unsigned long long> m_slots; // Slot to the sequence number of its newest frame
+        unsigned long long m_firstSequence = 0;
+        size_t m_sentOffset = 0;
+        size_t m_queued = 0;
+        unsigned long long m_sent = 0;
+        size_t m_maxQueued = defaultMaxQueued;
+        std::chrono::milliseconds m_lagBudget = defaultLagBudget;
+        bool m_backedUp = false;
+        std::chrono::steady_clock::time_point m_backedUpSince;
+    };
+}
+
+#endif //MULTIPONG_CONNECTION_HPP
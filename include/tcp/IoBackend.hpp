@@ -0,0 +1,72 @@
+#ifndef MULTIPONG_IOBACKEND_HPP
+#define MULTIPONG_IOBACKEND_HPP
+
+#include <vector>
+#include <algorithm>
+#include "Connection.hpp"
+#include "../sock/Poll.hpp"
+
+namespace tcp {
+    // Moves bytes between registered connections and the network once per tick. receive() fills each connection's
+    // inbound buffer and throws the usual sock::SocketException for a connection that went away, send() hands a
+    // connection's queue over and submit() is where a batching backend actually talks to the kernel.
+    class IoBackend {
+    public:
+        virtual ~IoBackend() = default;
+
+        virtual void add(Connection &connection) = 0;
+        // Must be called before the connection is closed or reassigned
+        virtual void remove(Connection &connection) = 0;
+        virtual void receive() = 0;
+        virtual void send(Connection &connection) = 0;
+        virtual void submit() = 0;
+        // Bytes the backend took out of the connection's queue that aren't in the socket yet
+        [[nodiscard]] virtual size_t pending(const Connection &connection) const = 0;
+
+        [[nodiscard]] virtual const char *name() const = 0;
+    };
+
+    class PollBackend : public IoBackend {
+    public:
+        void add(Connection &connection) override{
+            m_connections.push_back(&connection);
+        }
+
+        void remove(Connection &connection) override{
+            std::erase(m_connections, &connection);
+        }
+
+        void receive() override{
+            PollList pollList;
+            for (Connection *connection : m_connections) pollList.add(*connection, POLLIN);
+            if (pollList.poll(0) == 0) return;
+            for (Connection *connection : m_connections){
+                if (!pollList[*connection].canRead() && !pollList[*connection].hanged()) continue;
+                char buffer[4096];
+                sock::Socket::len_t read;
+                while ((read = connection->tryRecv(buffer, sizeof(buffer))) != 0)
+                    connection->inbound().insert(connection->inbound().end(), buffer, buffer + read);
+            }
+        }
+
+        void send(Connection &connection) override{
+            connection.flush();
+        }
+
+        void submit() override{
+
+        }
+
+        [[nodiscard]] size_t pending(const Connection &) const override{
+            return 0;
+        }
+
+        [[nodiscard]] const char *name() const override{
+            return "poll";
+        }
+    private:
+        std::vector<Connection *> m_connections;
+    };
+}
+
+#endif //MULTIPONG_IOBACKEND_HPP
@@ -0,0 +1,127 @@
+#ifndef MULTIPONG_SNAPSHOTPACER_HPP
+#define MULTIPONG_SNAPSHOTPACER_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+#include "Connection.hpp"
+
+namespace tcp {
+    // What the kernel knows about a connection's way out, zeroes where it can't tell (not TCP, old kernel)
+    struct LinkSample {
+        size_t outq = 0; // In the socket buffer, sent or not, until the peer acks it
+        size_t unsent = 0; // Part of outq not on the wire yet, held back by the congestion or receive window
+        size_t queued = 0; // Still in the connection's own queue
+        unsigned long long sent = 0; // Connection::sent() at the time of the sample
+        std::chrono::microseconds rtt{0}; // Smoothed, from the kernel's ack timing
+    };
+
+    // pending is what a backend took from the queue but hasn't handed to the socket, IoBackend::pending()
+    inline LinkSample sampleLink(const Connection &connection, size_t pending = 0){
+        LinkSample sample;
+        sample.queued = connection.queued() + pending;
+        sample.sent = connection.sent() - pending;
+        int bytes;
+        if (ioctl(connection.fd(), SIOCOUTQ, &bytes) == 0) sample.outq = bytes;
+        if (ioctl(connection.fd(), SIOCOUTQNSD, &bytes) == 0) sample.unsent = bytes;
+        tcp_info info{};
+        socklen_t length = sizeof(info);
+        if (getsockopt(connection.fd(), IPPROTO_TCP, TCP_INFO, &info, &length) == 0) sample.rtt = std::chrono::microseconds(info.tcpi_rtt);
+        return sample;
+    }
+
+    // Decides which simulation ticks a client gets a snapshot of. Every sample turns into an estimate of how long a
+    // snapshot queued now would wait before the client sees it: the backlog over the delivery rate measured from acked
+    // bytes, plus how far the RTT is above the lowest one seen. Above highWater the interval doubles, after raiseAfter
+    // samples below lowWater it shrinks by a quarter, and a shrink that gets undone right away doubles the wait. A
+    // skipped tick costs nothing, the next snapshot sent is always the newest state so a slow link gets fewer and
+    // fresher updates instead of a backlog.
+    class SnapshotPacer {
+    public:
+        static constexpr unsigned int maxInterval = 16;
+        static constexpr std::chrono::milliseconds highWater{25};
+        static constexpr std::chrono::milliseconds lowWater{5};
+        static constexpr unsigned int raiseAfter = 4;
+        static constexpr unsigned int maxRaiseAfter = 16;
+
+        // Once per simulation tick, true when this tick's snapshot should go out. The link is only sampled then.
+        bool due(const Connection &connection, size_t pending = 0){
+            if (++m_skipped < m_interval) return false;
+            m_skipped = 0;
+            update(sampleLink(connection, pending), std::chrono::steady_clock::now());
+            return true;
+        }
+
+        void update(const LinkSample &sample, std::chrono::steady_clock::time_point now){
+            size_t backlog = sample.unsent + sample.queued;
+            if (m_sampled) {
+                double elapsed = std::chrono::duration<double>(now - m_lastTime).count();
+                // Whatever went into the socket since the last sample and isn't in it anymore got acked
+                double acked = (double)(sample.sent - m_last.sent) + (double)m_last.outq - (double)sample.outq;
+                // With nothing waiting the link was idle part of the time, only a higher rate says anything then
+                double rate = elapsed > 0 ? std::max(acked, 0.) / elapsed : 0;
+                if (m_lastBacklog != 0 || rate > m_bandwidth) m_bandwidth += (rate - m_bandwidth) * (m_bandwidth == 0 ? 1 : .25);
+            }
+            if (sample.rtt.count() != 0 && (m_minRtt.count() == 0 || sample.rtt < m_minRtt)) m_minRtt = sample.rtt;
+            // On an idle link the smoothed RTT is mostly the client's delayed acks, it only means queueing while
+            // something is actually waiting
+            std::chrono::microseconds delay{0};
+            if (backlog != 0) {
+                delay = sample.rtt - m_minRtt;
+                // Capped at a second, a rate that decayed towards zero would overflow the cast
+                if (m_bandwidth > 0) delay += std::chrono::microseconds((long long)(std::min((double)backlog / m_bandwidth, 1.) * 1e6));
+                else if (m_sampled) delay += highWater * 2; // Nothing got through at all
+            }
+            m_delay = delay;
+            m_sinceRaise++;
+            if (delay > highWater) {
+                // The last raise didn't hold, probe less often so a link at its limit doesn't see-saw
+                if (m_sinceRaise <= m_raiseAfter) m_raiseAfter = std::min(m_raiseAfter * 2, maxRaiseAfter);
+                m_interval = std::min(m_interval * 2, maxInterval);
+                m_good = 0;
+            }
+            else if (delay < lowWater && ++m_good >= m_raiseAfter) {
+                if (m_interval > 1) m_interval -= std::max(m_interval / 4, 1u);
+                if (m_interval == 1) m_raiseAfter = raiseAfter;
+                m_good = 0;
+                m_sinceRaise = 0;
+            }
+            m_last = sample;
+            m_lastBacklog = backlog;
+            m_lastTime = now;
+            m_sampled = true;
+        }
+
+        // Snapshots go out every interval() ticks
+        [[nodiscard]] unsigned int interval() const{
+            return m_interval;
+        }
+
+        [[nodiscard]] std::chrono::microseconds delay() const{
+            return m_delay;
+        }
+
+        // Bytes per second, 0 until the first acks were seen
+        [[nodiscard]] double bandwidth() const{
+            return m_bandwidth;
+        }
+    private:
+        unsigned int m_interval = 1;
+        unsigned int m_skipped = 0;
+        unsigned int m_good = 0;
+        unsigned int m_raiseAfter = raiseAfter;
+        unsigned int m_sinceRaise = maxRaiseAfter;
+        bool m_sampled = false;
+        LinkSample m_last;
+        size_t m_lastBacklog = 0;
+        std::chrono::steady_clock::time_point m_lastTime;
+        double m_bandwidth = 0;
+        std::chrono::microseconds m_minRtt{0};
+        std::chrono::microseconds m_delay{0};
+    };
+}
+
+#endif //MULTIPONG_SNAPSHOTPACER_HPP
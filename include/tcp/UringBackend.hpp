@@ -0,0 +1,201 @@
+#ifndef MULTIPONG_URINGBACKEND_HPP
+#define MULTIPONG_URINGBACKEND_HPP
+
+#include <algorithm>
+#include <vector>
+#include "IoBackend.hpp"
+#include "../sock/Uring.hpp"
+
+namespace tcp {
+    // Keeps a multishot receive armed on every connection and sends each connection's queue with a single SEND,
+    // everything a tick prepared goes to the kernel in the one io_uring_enter done by submit(). A connection only
+    // ever has one send in flight, what gets queued meanwhile stays in its queue where newer snapshots can still
+    // replace older ones.
+    class UringBackend : public IoBackend {
+        enum Operation : unsigned long long {
+            Receive, Send, Cancel
+        };
+
+        struct Slot {
+            Connection *connection = nullptr; // nullptr once removed, the slot is reused when its operations are done
+            bool receiveArmed = false;
+            bool sending = false;
+            bool closed = false;
+            int error = 0;
+            int sendResult = 0; // Of the last SEND that completed
+            std::vector<char> sendBuffer; // Owned here so it outlives the connection if it is removed mid send
+        };
+    public:
+        explicit UringBackend(unsigned entries = 256, unsigned bufferCount = 256, unsigned bufferSize = 2048) : m_ring(entries, bufferCount, bufferSize){
+
+        }
+
+        void add(Connection &connection) override{
+            size_t index = 0;
+            while (index < m_slots.size() && (m_slots[index].connection != nullptr || m_slots[index].receiveArmed || m_slots[index].sending)) index++;
+            if (index == m_slots.size()) m_slots.emplace_back();
+            Slot &slot = m_slots[index];
+            slot.connection = &connection;
+            slot.closed = false;
+            slot.error = 0;
+            slot.sendBuffer.clear();
+            arm(index);
+        }
+
+        // Cancels what the ring still does with the connection and waits for it, so the socket can be closed or
+        // handed to someone else right after. Data that was still arriving ends up in inbound() and whatever a
+        // cancelled send didn't get out goes back into the connection's queue, nothing is lost mid frame.
+        void remove(Connection &connection) override{
+            for (size_t i = 0; i < m_slots.size(); i++){
+                Slot &slot = m_slots[i];
+                if (slot.connection != &connection) continue;
+                bool wasSending = slot.sending;
+                // A send blocked on a client that stopped reading would otherwise hold the slot forever
+                bool receiveCancelled = !slot.receiveArmed, sendCancelled = !slot.sending;
+                while (slot.receiveArmed || slot.sending){
+                    // A cancel that didn't fit in a full ring goes in once completions made room
+                    if (!receiveCancelled) receiveCancelled = cancel(tag(Receive, i), i);
+                    if (!sendCancelled) sendCancelled = cancel(tag(Send, i), i);
+                    m_ring.submit(1);
+                    m_ring.reap([this](const io_uring_cqe &cqe){ complete(cqe); });
+                }
+                if (wasSending){
+                    // A cancelled send reports what it got out before it stopped
+                    size_t sent = std::min((size_t)std::max(slot.sendResult, 0), slot.sendBuffer.size());
+                    connection.requeueTaken(slot.sendBuffer.data() + sent, slot.sendBuffer.size() - sent);
+                }
+                slot.connection = nullptr;
+            }
+        }
+
+        void receive() override{
+            m_ring.reap([this](const io_uring_cqe &cqe){ complete(cqe); });
+            for (size_t i = 0; i < m_slots.size(); i++){
+                Slot &slot = m_slots[i];
+                if (slot.connection == nullptr) continue;
+                if (slot.closed){
+                    if (slot.error != 0) throw sock::ReadException("recv", slot.connection->fd());
+                    throw sock::DisconnectionException(slot.connection->fd());
+                }
+                if (!slot.receiveArmed) arm(i);
+            }
+        }
+
+        void send(Connection &connection) override{
+            for (size_t i = 0; i < m_slots.size(); i++){
+                Slot &slot = m_slots[i];
+                if (slot.connection != &connection) continue;
+                if (slot.sending){
+                    connection.checkLag(true);
+                    return;
+                }
+                slot.sendBuffer.clear();
+                if (connection.takeQueued(slot.sendBuffer)){
+                    io_uring_sqe *sqe = next();
+                    if (sqe == nullptr){
+                        // The ring is full, the bytes go out with the next send
+                        connection.requeueTaken(slot.sendBuffer.data(), slot.sendBuffer.size());
+                        connection.checkLag(false);
+                        return;
+                    }
+                    sqe->opcode = IORING_OP_SEND;
+                    sqe->fd = connection.fd();
+                    sqe->addr = (unsigned long long)slot.sendBuffer.data();
+                    sqe->len = slot.sendBuffer.size();
+                    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+                    sqe->user_data = tag(Send, i);
+                    slot.sending = true;
+                }
+                connection.checkLag(false);
+                return;
+            }
+        }
+
+        void submit() override{
+            m_ring.submit();
+        }
+
+        // A SEND counts its whole buffer as sent in the connection the moment it is prepared
+        [[nodiscard]] size_t pending(const Connection &connection) const override{
+            for (const Slot &slot : m_slots)
+                if (slot.connection == &connection && slot.sending) return slot.sendBuffer.size();
+            return 0;
+        }
+
+        [[nodiscard]] const char *name() const override{
+            return "io_uring";
+        }
+    private:
+        static unsigned long long tag(Operation operation, size_t index){
+            return (index << 2) | operation;
+        }
+
+        // nullptr when the kernel didn't take what was queued either, the caller tries again later
+        io_uring_sqe *next(){
+            io_uring_sqe *sqe = m_ring.sqe();
+            if (sqe != nullptr) return sqe;
+            m_ring.submit();
+            return m_ring.sqe();
+        }
+
+        // The operation's own completion still arrives, with -ECANCELED unless it finished first. False when the
+        // cancel didn't fit in the ring.
+        bool cancel(unsigned long long target, size_t index){
+            io_uring_sqe *sqe = next();
+            if (sqe == nullptr) return false;
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = target;
+            sqe->user_data = tag(Cancel, index);
+            return true;
+        }
+
+        // Left unarmed when the ring is full, receive() arms it on the next call
+        void arm(size_t index){
+            io_uring_sqe *sqe = next();
+            if (sqe == nullptr) return;
+            sqe->opcode = IORING_OP_RECV;
+            sqe->fd = m_slots[index].connection->fd();
+            sqe->ioprio = IORING_RECV_MULTISHOT;
+            sqe->flags = IOSQE_BUFFER_SELECT;
+            sqe->buf_group = sock::Uring::bufferGroup;
+            sqe->user_data = tag(Receive, index);
+            m_slots[index].receiveArmed = true;
+        }
+
+        void complete(const io_uring_cqe &cqe){
+            auto operation = (Operation)(cqe.user_data & 3);
+            Slot &slot = m_slots[cqe.user_data >> 2];
+            if (operation == Send){
+                slot.sending = false;
+                slot.sendResult = cqe.res;
+                if (cqe.res < 0 || (size_t)cqe.res != slot.sendBuffer.size()){
+                    slot.closed = true;
+                    slot.error = cqe.res < 0 ? -cqe.res : EPIPE;
+                }
+            }
+            if (operation != Receive) return;
+            if (cqe.flags & IORING_CQE_F_BUFFER){
+                unsigned id = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+                if (cqe.res > 0 && slot.connection != nullptr){
+                    const char *data = m_ring.buffer(id);
+                    slot.connection->inbound().insert(slot.connection->inbound().end(), data, data + cqe.res);
+                }
+                m_ring.recycle(id);
+            }
+            // Without F_MORE the kernel stopped this receive, receive() re-arms it unless the peer is gone
+            if (!(cqe.flags & IORING_CQE_F_MORE)) slot.receiveArmed = false;
+            if (cqe.res == 0){
+                slot.closed = true;
+            }
+            else if (cqe.res < 0 && cqe.res != -ENOBUFS && cqe.res != -ECANCELED){
+                slot.closed = true;
+                slot.error = -cqe.res;
+            }
+        }
+
+        sock::Uring m_ring;
+        std::vector<Slot> m_slots;
+    };
+}
+
+#endif //MULTIPONG_URINGBACKEND_HPP
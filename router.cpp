@@ -0,0 +1,126 @@
+#include <sock/Poll.hpp>
+#include <tcp/TcpServer.hpp>
+#include <shard/Control.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <tuple>
+#include <vector>
+#include <netinet/tcp.h>
+
+// Front door for several Server processes started with --shard. Clients connect here and are handed to a shard with
+// their socket passed over the shard's control connection, after that the router is out of the picture.
+
+struct Shard {
+    sock::Socket control;
+    int number;
+    bool reported = false;
+    shard::ShardLoad load{};
+    unsigned int sent = 0; // Compared with load.received, tells how many players the last report didn't know about yet
+};
+
+unsigned int occupancy(const Shard &shard){
+    return shard.load.players + (shard.sent - shard.load.received);
+}
+
+// Lobbies with someone already waiting come first so players get a match, then the shard keeping up best with the fewest
+// matches. Shards in skip already turned this player down.
+Shard *pickShard(std::vector<Shard> &shards, const std::vector<Shard *> &skip){
+    Shard *best = nullptr;
+    auto rank = [](const Shard &shard){
+        bool waiting = shard.load.matches == 0 && occupancy(shard) > 0;
+        return std::make_tuple(!waiting, std::lround(shard.load.overrunRate * 100), shard.load.matches, occupancy(shard));
+    };
+    for (Shard &shard : shards) {
+        if (!shard.reported || occupancy(shard) >= shard.load.seats || std::ranges::find(skip, &shard) != skip.end()) continue;
+        if (best == nullptr || rank(shard) < rank(*best)) best = &shard;
+    }
+    return best;
+}
+
+// false once the shard is gone
+bool readReports(Shard &shard){
+    shard::ShardLoad load{};
+    ssize_t read;
+    while ((read = ::recv(shard.control.fd(), &load, sizeof(load), MSG_DONTWAIT)) > 0) {
+        if (read != sizeof(load)) continue;
+        shard.load = load;
+        shard.reported = true;
+    }
+    return read == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+int main(int argc, char **argv){
+    const char *address = "127.0.0.1";
+    std::string controlPath = "multipong.sock";
+    for (int i = 1; i < argc; i++){
+        std::string arg = argv[i];
+        if (arg == "--control" && i + 1 < argc) controlPath = argv[++i];
+        else address = argv[i];
+    }
+    sock::Socket control = shard::listenControl(controlPath);
+    std::cout << "Waiting for shards on " << controlPath << "\n";
+    tcp::TcpServer server;
+    int t = 1;
+    setsockopt(server.fd(), SOL_SOCKET, SO_REUSEADDR, &t, 4);
+    setsockopt(server.fd(), IPPROTO_TCP, TCP_NODELAY, &t, 4);
+    std::cout << "Binding to " << address << "\n";
+    server.bind(sock::IPAddress::parse(address), 25565);
+    server.listen(64);
+    std::cout << "Router on! ^w^" << std::endl;
+    std::vector<Shard> shards;
+    int nextNumber = 1;
+    while (true){
+        PollList pollList;
+        pollList.add(server, POLLIN);
+        pollList.add(control, POLLIN);
+        for (const Shard &shard : shards) pollList.add(shard.control, POLLIN);
+        pollList.poll();
+        if (pollList[control].canRead()) {
+            try {
+                shards.push_back({control.accept(), nextNumber++});
+                std::cout << "Shard " << shards.back().number << " joined" << std::endl;
+            } catch (sock::AcceptException &e) {
+                std::cout << "Could not accept a shard (" << std::strerror(e.error()) << ")" << std::endl;
+            }
+        }
+        std::erase_if(shards, [&pollList](Shard &shard){
+            auto result = pollList[shard.control];
+            if (!result.canRead() && !result.hanged()) return false;
+            if (readReports(shard)) return false;
+            std::cout << "Shard " << shard.number << " left" << std::endl;
+            shard.control.close();
+            return true;
+        });
+        if (pollList[server].canRead()) {
+            sock::Socket client(-1);
+            try {
+                client = server.accept();
+            } catch (sock::AcceptException &e) {
+                // Aborted handshakes are gone for good, running out of fds clears up as players leave
+                std::cout << "Could not accept a player (" << std::strerror(e.error()) << ")" << std::endl;
+                continue;
+            }
+            // A shard that stopped reading its control socket must not hold up everyone else, the player goes to the next best one
+            std::vector<Shard *> tried;
+            Shard *shard;
+            while ((shard = pickShard(shards, tried)) != nullptr) {
+                try {
+                    if (shard::sendClient(shard->control, client)) {
+                        shard->sent++;
+                        std::cout << "Player sent to shard " << shard->number << std::endl;
+                        break;
+                    }
+                    std::cout << "Shard " << shard->number << " is not taking players right now" << std::endl;
+                } catch (shard::ControlException &e) {
+                    std::cout << "Could not hand a player to shard " << shard->number << " (" << e.what() << ")" << std::endl;
+                }
+                tried.push_back(shard);
+            }
+            if (shard == nullptr) std::cout << "No shard has a free seat, turning a player away" << std::endl;
+            client.close();
+        }
+    }
+}
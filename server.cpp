@@ -1,264 +1,893 @@
-#include <sock/Poll.hpp>
 #include <tcp/TcpServer.hpp>
+#include <tcp/Connection.hpp>
+#include <tcp/IoBackend.hpp>
+#include <tcp/UringBackend.hpp>
+#include <tcp/SnapshotPacer.hpp>
+#include <pong/Protocol.hpp>
+#include <pong/Simulation.hpp>
+#include <pong/Rollback.hpp>
+#include <pong/Arena.hpp>
+#include <logging/Logger.hpp>
+#include <store/MatchStore.hpp>
+#include <rt/Realtime.hpp>
+#include <rt/TickPipeline.hpp>
+#include <rt/TimerWheel.hpp>
+#include <shard/Control.hpp>
+#include <coro/AsyncSocket.hpp>
+#include <check/SelfCheck.hpp>
 #include <chrono>
 #include <cmath>
 #include <iostream>
+#include <list>
+#include <memory>
+#include <optional>
 #include <thread>
+#include <cstring>
 #include <netinet/tcp.h>
+#include <sys/resource.h>
 
-enum MessageType : char {
-    MovePad, Tick, BallUpdate, PadUpdate, ScoreUpdate, PlayerAssignment, GameStart, GameEnd
-};
-
-struct __attribute__((packed)) MessageHeader {
-    MessageType type;
-    unsigned int length;
-};
-
-struct Message {
-    MessageHeader header{MovePad, 0};
-    std::string data;
-};
+// Fixed point gives the same match on every build, the float physics is the original behaviour
+#ifdef MULTIPONG_FIXED_POINT
+using Simulation = pong::FixedSimulation;
+constexpr const char *physicsName = "fixed point";
+#else
+using Simulation = pong::FloatSimulation;
+constexpr const char *physicsName = "floating point";
+#endif
 
 std::chrono::nanoseconds fetchTime(){
     return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now().time_since_epoch());
 }
 
-Message fetchMessage(sock::Socket socket){
-    Message message;
-    socket.recv(&message.header, 5, MSG_WAITALL);
-    message.data.resize(message.header.length);
-    socket.recv(message.data.data(), message.header.length, MSG_WAITALL);
-    return message;
+// Takes the next complete message out of what the backend received so far, a peer announcing a frame larger than the
+// lobby would take is treated like a broken connection
+bool takeMessage(tcp::Connection &connection, Message &message){
+    std::vector<char> &inbound = connection.inbound();
+    if (inbound.size() < sizeof(MessageHeader)) return false;
+    std::memcpy(&message.header, inbound.data(), sizeof(MessageHeader));
+    if (message.header.length > coro::AsyncSocket::maxFrame) throw sock::ReadException("frame too large", connection.fd());
+    if (inbound.size() < sizeof(MessageHeader) + message.header.length) return false;
+    message.data.assign(inbound.data() + sizeof(MessageHeader), message.header.length);
+    inbound.erase(inbound.begin(), inbound.begin() + (long)(sizeof(MessageHeader) + message.header.length));
+    return true;
+}
+
+void appendMessage(std::vector<char> &buffer, MessageType type, unsigned int length, const void *data){
+    MessageHeader header{type, length};
+    buffer.insert(buffer.end(), (const char *)&header, (const char *)&header + sizeof(header));
+    buffer.insert(buffer.end(), (const char *)data, (const char *)data + length);
 }
 
-void writeMessage(sock::Socket socket, MessageType type, unsigned int length, const void *data){
-    socket.send(&type, 1, MSG_NOSIGNAL);
-    socket.send(&length, 4, MSG_NOSIGNAL);
-    socket.send(data, length, MSG_NOSIGNAL);
+// Queued on the connection, nothing goes out until it is flushed
+void writeMessage(tcp::Connection &connection, MessageType type, unsigned int length, const void *data){
+    std::vector<char> buffer;
+    appendMessage(buffer, type, length, data);
+    connection.queue(buffer.data(), buffer.size());
 }
 
-void broadcastMessage(std::initializer_list<sock::Socket> sockets, MessageType type, unsigned int length, const void *data){
-    for (sock::Socket socket : sockets)
-        writeMessage(socket, type, length, data);
+void broadcastMessage(std::initializer_list<tcp::Connection *> connections, MessageType type, unsigned int length, const void *data){
+    for (tcp::Connection *connection : connections)
+        writeMessage(*connection, type, length, data);
 }
 
-bool rectIntersect(double x1, double y1, double w1, double h1, double x2, double y2, double w2, double h2){
-    return x1 < x2 + w2 &&
-           x1 + w1 > x2 &&
-           y1 < y2 + h2 &&
-           y1 + h1 > y2;
+// A tick's BallUpdate, PadUpdate and Tick go out as one frame, a client that can't keep up gets the newest one in place of the old
+void writeSnapshot(tcp::Connection &connection, const Position &ball, const double (&pads)[2], const TickInfo &info){
+    std::vector<char> buffer;
+    appendMessage(buffer, BallUpdate, sizeof(Position), &ball);
+    appendMessage(buffer, PadUpdate, sizeof(double) * 2, pads);
+    appendMessage(buffer, Tick, sizeof(TickInfo), &info);
+    connection.queueLatest(Tick, buffer.data(), buffer.size());
 }
 
-struct Position {
-    double x, y;
+// One tick of a two player match as the send stage gets it, copied out of the simulation so the next tick can go ahead
+struct TickSnapshot {
+    Position ball;
+    double pads[2];
+    int scores[2];
+    bool scored;
+    TickInfo info[2];
 };
 
-#define WIN_SIZEX 800
-#define WIN_SIZEY 600
-#define PAD_SIZEX 10
-#define PAD_SIZEY 80
-#define BALL_SIZE 10
-#define PAD_OFFST 20
-#define BALL_DSPD 400
-#define BALL_MSPD 600
-#define TPS 144
-
-void lobbyPollMessages(sock::Socket &server, sock::Socket &player1, sock::Socket &player2){
-    PollList pollList;
-    pollList.add(server, POLLIN);
-    if (player1 != 0) pollList.add(player1, POLLIN);
-    if (player2 != 0) pollList.add(player2, POLLIN);
-    while (pollList.poll(0) != 0) {
-        if (pollList[server].canRead()){
-            if (player1 == 0) {
-                player1 = server.accept();
-                int player = 1;
-                writeMessage(player1, PlayerAssignment, sizeof(int), &player);
-                std::cout << "[SERVER] P1 connected\n";
-            }
-            else if (player2 == 0) {
-                player2 = server.accept();
-                int player = 2;
-                writeMessage(player2, PlayerAssignment, sizeof(int), &player);
-                std::cout << "[SERVER] P2 connected\n";
+std::string peerName(const sock::Socket &socket){
+    sockaddr_storage addr{};
+    socklen_t len = sizeof(addr);
+    char name[INET6_ADDRSTRLEN]{};
+    if (getpeername(socket.fd(), (sockaddr *)&addr, &len) == -1) return "unknown";
+    if (addr.ss_family == AF_INET) inet_ntop(AF_INET, &((sockaddr_in *)&addr)->sin_addr, name, sizeof(name));
+    else if (addr.ss_family == AF_INET6) inet_ntop(AF_INET6, &((sockaddr_in6 *)&addr)->sin6_addr, name, sizeof(name));
+    return name;
+}
+
+void submitMatch(store::MatchStore &results, const std::string (&players)[2], int p1Score, int p2Score, std::chrono::nanoseconds startTime, unsigned long long ticks){
+    store::MatchRecord record{};
+    record.endTime = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    record.duration = (fetchTime() - startTime).count();
+    record.ticks = ticks;
+    record.scores[0] = p1Score;
+    record.scores[1] = p2Score;
+    for (int i = 0; i < 2; i++)
+        std::strncpy(record.players[i], players[i].c_str(), sizeof(record.players[i]) - 1);
+    if (!results.submit(record)) logging::log(logging::ResultDropped, p1Score, p2Score);
+}
+
+void printLeaderboard(const store::MatchStore &results, size_t count){
+    std::cout << "Leaderboard (" << results.index().size() << " matches played)\n";
+    size_t rank = 1;
+    for (const store::PlayerStats &player : results.index().leaderboard(count))
+        std::cout << rank++ << ". " << player.name << " - " << player.wins << " wins, " << player.losses << " losses, " << player.points << " points\n";
+}
+
+void printHistory(const store::MatchStore &results, const std::string &player, size_t count){
+    std::cout << "Last matches of " << player << "\n";
+    for (const store::MatchRecord &record : results.index().history(player, count))
+        std::cout << record.players[0] << " " << record.scores[0] << " - " << record.scores[1] << " " << record.players[1]
+                  << " (" << record.duration / 1000000000 << "s, " << record.ticks << " ticks)\n";
+}
+
+template<class Apply>
+void attempt(const char *what, Apply &&apply){
+    try {
+        apply();
+    } catch (rt::RealtimeException &e) {
+        std::cout << "Could not " << what << " (" << e.what() << ")\n";
+    }
+}
+
+void applyProfile(const rt::Profile &profile, store::MatchStore &results){
+    if (profile.tickCpu != -1) attempt("pin the tick thread", [&]{ rt::pinThread(pthread_self(), profile.tickCpu); });
+    if (profile.ioCpu != -1) {
+        attempt("pin the logger thread", [&]{ rt::pinThread(logging::logger().nativeHandle(), profile.ioCpu); });
+        attempt("pin the results thread", [&]{ rt::pinThread(results.nativeHandle(), profile.ioCpu); });
+    }
+    // Only the tick thread goes real-time, the I/O threads must not be able to starve it
+    if (profile.fifoPriority != 0) attempt("switch the tick thread to SCHED_FIFO", [&]{ rt::setFifo(pthread_self(), profile.fifoPriority); });
+    if (profile.lockMemory) attempt("lock memory", [&]{ rt::lockMemory(); });
+}
+
+// Threads started after applyProfile copy the tick thread's core and SCHED_FIFO, an I/O thread gives both up
+void applyIoProfile(const rt::Profile &profile, pthread_t thread, const char *name){
+    std::string move = std::string("move the ") + name + " off the tick thread's core";
+    std::string other = std::string("switch the ") + name + " back to SCHED_OTHER";
+    if (profile.ioCpu != -1) attempt(move.c_str(), [&]{ rt::pinThread(thread, profile.ioCpu); });
+    else if (profile.tickCpu != -1) attempt(move.c_str(), [&]{ rt::avoidCpu(thread, profile.tickCpu); });
+    if (profile.fifoPriority != 0) attempt(other.c_str(), [&]{ rt::setOther(thread); });
+}
+
+// Clients waiting for a seat. Each one is a coroutine suspended on the lobby's event loop that reads and drops whatever
+// the client sends, so an idle client costs a pooled frame and an epoll entry and the tick loop never looks at it. A
+// shard's listening socket is its control socket to the router, players arrive there as passed fds.
+class Lobby {
+public:
+    Lobby(sock::Socket &server, shard::Reporter *reporter) : m_server(server), m_reporter(reporter){
+        coro::spawn(acceptClients());
+    }
+
+    // Accepts, reads and notices hang ups, never blocks. Throws shard::ControlException once the router is gone.
+    void run(){
+        m_loop.runOnce(0);
+        if (m_routerLost) std::rethrow_exception(m_routerLost);
+    }
+
+    // Gives the longest waiting client a seat, false when nobody is waiting
+    bool seat(tcp::IoBackend &backend, tcp::Connection &player, int number, int busyPoll, std::chrono::milliseconds lagBudget){
+        if (m_waiting.empty()) return false;
+        coro::AsyncSocket *client = m_waiting.front();
+        m_waiting.pop_front();
+        // The waiting coroutine finishes on the next run, the socket and anything it read past the last frame are ours now
+        m_loop.cancel(client->socket().fd());
+        player = tcp::Connection(client->socket());
+        player.inbound() = std::move(client->buffered());
+        player.setLagBudget(lagBudget);
+        if (busyPoll != 0) {
+            try {
+                rt::busyPoll(player.fd(), busyPoll);
+            } catch (rt::RealtimeException &) {
+                // Already reported once at startup on the listening socket
             }
         }
-        if (pollList[player1].canRead()){
+        backend.add(player);
+        writeMessage(player, PlayerAssignment, sizeof(int), &number);
+        logging::log(logging::PlayerConnected, number);
+        return true;
+    }
+
+    // A player whose match ended waits again ahead of everyone else, once the end of the match is sent
+    void requeue(sock::Socket socket, std::vector<char> received, std::vector<char> unsent){
+        coro::spawn(waitForSeat(socket, std::move(received), std::move(unsent), true));
+    }
+
+    [[nodiscard]] size_t waiting() const{
+        return m_waiting.size();
+    }
+private:
+    coro::Task<sock::Socket> nextClient(coro::AsyncSocket &listener){
+        if (m_reporter == nullptr) co_return co_await listener.accept();
+        co_await m_loop.readable(m_server.fd());
+        sock::Socket client = shard::receiveClient(m_server);
+        m_reporter->received();
+        co_return client;
+    }
+
+    coro::Task<void> acceptClients(){
+        coro::AsyncSocket listener(m_loop, m_server);
+        unsigned int failures = 0;
+        auto lastReport = std::chrono::steady_clock::time_point{};
+        while (true) {
+            bool failed = false;
             try {
-                Message message = fetchMessage(player1);
-            }catch(sock::DisconnectionException &){
-                player1.close();
-                std::cout << "[SERVER] P1 disconnected in lobby\n";
-                player1 = sock::Socket{0};
-                break;
+                coro::spawn(waitForSeat(co_await nextClient(listener)));
+            } catch (sock::AcceptException &e) {
+                // Most likely out of fds, which the listener keeps being readable through, so at most one try a tick
+                // and one line a second
+                failed = true;
+                failures++;
+                if (std::chrono::steady_clock::now() - lastReport >= std::chrono::seconds(1)) {
+                    lastReport = std::chrono::steady_clock::now();
+                    std::cout << "Could not accept a player (" << std::strerror(e.error()) << "), " << failures << (failures == 1 ? " time" : " times") << " since the last report" << std::endl;
+                    failures = 0;
+                }
+            } catch (shard::ControlException &) {
+                // Nobody awaits this coroutine, run() hands the failure to the tick loop
+                m_routerLost = std::current_exception();
+                co_return;
             }
+            if (failed) co_await m_loop.nextRun();
         }
-        if (pollList[player2].canRead()){
-            try {
-                Message message = fetchMessage(player2);
-            }catch(sock::DisconnectionException &){
-                player2.close();
-                std::cout << "[SERVER] P2 disconnected in lobby\n";
-                player2 = sock::Socket{0};
-                break;
+    }
+
+    coro::Task<void> waitForSeat(sock::Socket socket, std::vector<char> received = {}, std::vector<char> unsent = {}, bool first = false){
+        coro::AsyncSocket client(m_loop, socket);
+        client.buffered() = std::move(received);
+        try {
+            // Not in the queue yet, a seat mustn't take the socket halfway through this
+            if (!unsent.empty()) co_await client.send(unsent);
+        } catch (sock::SocketException &) {
+            socket.close();
+            co_return;
+        }
+        auto entry = m_waiting.insert(first ? m_waiting.begin() : m_waiting.end(), &client);
+        logging::log(logging::PlayerWaiting, (long long)m_waiting.size());
+        try {
+            while (true) (void)co_await client.recvFrame();
+        } catch (coro::Cancelled &) {
+            // Seated, the entry is already gone
+        } catch (sock::SocketException &) {
+            m_waiting.erase(entry);
+            socket.close();
+            logging::log(logging::WaitingPlayerLeft, (long long)m_waiting.size());
+        }
+    }
+
+    sock::Socket &m_server;
+    shard::Reporter *m_reporter;
+    coro::EventLoop m_loop;
+    std::list<coro::AsyncSocket *> m_waiting;
+    std::exception_ptr m_routerLost;
+};
+
+void dropPlayer(tcp::IoBackend &backend, tcp::Connection &player){
+    backend.remove(player);
+    player.close();
+    player = tcp::Connection{};
+}
+
+void gamePollMessages(tcp::IoBackend &backend, tcp::Connection &player1, tcp::Connection &player2, Simulation::State &state, unsigned int &lastInput1, unsigned int &lastInput2){
+    backend.receive();
+    Message message;
+    for (tcp::Connection *player : {&player1, &player2}) {
+        while (takeMessage(*player, message)) {
+            if (message.header.type == MovePad && message.data.size() >= sizeof(int)) {
+                // Anything past one step a tick would let a client move its pad faster than the rules allow
+                PadInput input{};
+                std::memcpy(&input, message.data.data(), std::min(message.data.size(), sizeof(PadInput)));
+                Simulation::Scalar &pad = state.pads[player == &player1 ? 0 : 1];
+                pad = Simulation::stepPad(pad, std::clamp(input.direction, -1, 1), state.tickRate);
+                if (message.data.size() >= sizeof(PadInput)) (player == &player1 ? lastInput1 : lastInput2) = input.sequence;
             }
         }
     }
 }
 
-void gamePollMessages(sock::Socket &player1, sock::Socket &player2, const double &padSpeed, double &pad1, double &pad2){
-    PollList pollList;
-    pollList.add(player1, POLLIN);
-    pollList.add(player2, POLLIN);
-    while (pollList.poll(0) != 0) {
-        for (const auto &result: pollList.results()) {
-            if (result.hanged() || result.closed()){
-                std::cout << (result.socket() == player1 ? "P1 disconnected :c\n" : "P2 disconnected :c\n");
-                pollList.remove(result.socket());
-                break;
+// Rollback mode: inputs go straight through to the opponent, the server only runs the confirmed match to keep the score
+void rollbackPollMessages(tcp::IoBackend &backend, tcp::Connection &player1, tcp::Connection &player2, pong::RollbackArbiter &arbiter){
+    backend.receive();
+    Message message;
+    for (int player = 0; player < 2; player++) {
+        tcp::Connection &connection = player == 0 ? player1 : player2;
+        while (takeMessage(connection, message)) {
+            if (message.header.type != InputFrame || message.data.size() < sizeof(TickInput)) continue;
+            TickInput input;
+            std::memcpy(&input, message.data.data(), sizeof(input));
+            if (arbiter.input(player, input)) writeMessage(player == 0 ? player2 : player1, InputFrame, sizeof(TickInput), &input);
+            else logging::log(logging::InputRejected, player + 1, input.tick);
+        }
+    }
+    while (arbiter.ready()) {
+        if (arbiter.step() != 0)
+            broadcastMessage({&player1, &player2}, ScoreUpdate, sizeof(int) * 2, arbiter.state().scores);
+    }
+}
+
+// Below minTickRate the fastest ball moves further than a pad is wide in one tick and goes straight through it
+constexpr int minTickRate = 60, maxTickRate = 1000;
+
+struct MatchConfig {
+    std::chrono::steady_clock::time_point epoch; // Phases count from here
+    int rollbackDelay;
+    int busyPoll;
+    std::chrono::milliseconds lagBudget;
+    bool pipelined;
+    bool adaptiveSnapshots;
+};
+
+// A two player match with its own connections and backend. It is only on the timer wheel while it is being played and
+// then ticks at its own rate and phase, so a process full of matches doesn't run them all at the same instant. The
+// rate goes to the clients in GameStart, the physics and their interpolation step by it.
+class Match {
+public:
+    Match(const MatchConfig &config, int tickRate, std::chrono::nanoseconds phase, std::unique_ptr<tcp::IoBackend> backend, rt::TimerWheel &wheel, Lobby &lobby, store::MatchStore &results)
+        : m_config(config), m_tickRate(tickRate), m_period((long long)(1. / tickRate * 1000000000)), m_phase(phase), m_backend(std::move(backend)), m_wheel(wheel), m_lobby(lobby), m_results(results),
+          m_pipeline([this](const TickSnapshot &snapshot){ send(snapshot); }, config.pipelined), m_timer([this]{ tick(); }){
+
+    }
+
+    // Seats the two players who waited longest, there have to be two
+    void start(){
+        m_lobby.seat(*m_backend, m_player1, 1, m_config.busyPoll, m_config.lagBudget);
+        m_lobby.seat(*m_backend, m_player2, 2, m_config.busyPoll, m_config.lagBudget);
+        logging::log(logging::GameStarting);
+        GameSettings settings{m_config.rollbackDelay >= 0 ? Rollback : ServerAuthoritative, (unsigned char)std::clamp(m_config.rollbackDelay, 0, (int)pong::RollbackSession::maxInputDelay), (unsigned short)m_tickRate};
+        broadcastMessage({&m_player1, &m_player2}, GameStart, sizeof(GameSettings), &settings);
+        m_state = Simulation::start(m_tickRate);
+        if (m_config.rollbackDelay >= 0) m_arbiter.emplace(settings.inputDelay, m_tickRate);
+        else m_arbiter.reset();
+        m_lastInput1 = 0;
+        m_lastInput2 = 0;
+        m_pacers[0] = m_pacers[1] = tcp::SnapshotPacer{};
+        m_names[0] = peerName(m_player1);
+        m_names[1] = peerName(m_player2);
+        m_startTime = fetchTime();
+        m_startTick = m_tick;
+        broadcastMessage({&m_player1, &m_player2}, ScoreUpdate, sizeof(int) * 2, m_state.scores);
+        double pads[2]{Simulation::pad(m_state, 0), Simulation::pad(m_state, 1)};
+        broadcastMessage({&m_player1, &m_player2}, PadUpdate, sizeof(double) * 2, pads);
+        m_running = true;
+        m_deadline = nextPhase(std::chrono::steady_clock::now());
+        m_wheel.schedule(m_timer, m_deadline);
+    }
+
+    [[nodiscard]] bool running() const{
+        return m_running;
+    }
+
+    [[nodiscard]] int tickRate() const{
+        return m_tickRate;
+    }
+
+    // Whether a tick ran late since the last call
+    bool takeOverran(){
+        return std::exchange(m_overran, false);
+    }
+
+    rt::StageTimes takeTimes(){
+        return m_pipeline.takeTimes();
+    }
+
+    // The send stage's thread, which started out with the tick thread's core and scheduling
+    [[nodiscard]] std::optional<pthread_t> sendThread(){
+        if (!m_pipeline.threaded()) return std::nullopt;
+        return m_pipeline.nativeHandle();
+    }
+private:
+    void tick(){
+        try {
+            m_tick++;
+            if (m_arbiter) {
+                rollbackPollMessages(*m_backend, m_player1, m_player2, *m_arbiter);
+                m_backend->send(m_player1);
+                m_backend->send(m_player2);
+            }
+            else {
+                m_pipeline.startTick();
+                gamePollMessages(*m_backend, m_player1, m_player2, m_state, m_lastInput1, m_lastInput2);
+                bool scored = Simulation::step(m_state) != 0;
+                m_pipeline.publish({Simulation::ball(m_state), {Simulation::pad(m_state, 0), Simulation::pad(m_state, 1)},
+                                    {m_state.scores[0], m_state.scores[1]}, scored, {{m_tick, m_lastInput1}, {m_tick, m_lastInput2}}});
             }
-            if (result.canRead()) {
-                Message message = fetchMessage(result.socket());
-                if (message.header.type == MovePad) {
-                    double &pad = (result.socket() == player1 ? pad1 : pad2);
-                    pad += *(int *)(message.data.data()) * padSpeed / TPS;
-                    if (pad - PAD_SIZEY / 2. < 0) pad = PAD_SIZEY / 2.;
-                    if (pad + PAD_SIZEY / 2. >= WIN_SIZEY) pad = WIN_SIZEY - PAD_SIZEY / 2.;
-                    double pads[2]{pad1, pad2};
-                    broadcastMessage({player1, player2}, PadUpdate, sizeof(double) * 2, pads);
+            m_backend->submit();
+        } catch (sock::SocketException &e) {
+            end(e.socket);
+            return;
+        }
+        m_deadline += m_period;
+        // After a long stall skip ahead instead of running a burst of catch-up ticks, still on the match's phase
+        auto now = std::chrono::steady_clock::now();
+        if (m_deadline < now) {
+            m_overran = true;
+            m_deadline = nextPhase(now);
+        }
+        m_wheel.schedule(m_timer, m_deadline);
+    }
+
+    void send(const TickSnapshot &snapshot){
+        if (snapshot.scored) broadcastMessage({&m_player1, &m_player2}, ScoreUpdate, sizeof(int) * 2, snapshot.scores);
+        tcp::Connection *players[2]{&m_player1, &m_player2};
+        for (int i = 0; i < 2; i++) {
+            if (m_config.adaptiveSnapshots) {
+                unsigned int interval = m_pacers[i].interval();
+                if (!m_pacers[i].due(*players[i], m_backend->pending(*players[i]))) continue;
+                if (m_pacers[i].interval() != interval)
+                    logging::log(logging::SnapshotInterval, i + 1, m_pacers[i].interval(), m_pacers[i].delay().count());
+            }
+            writeSnapshot(*players[i], snapshot.ball, snapshot.pads, snapshot.info[i]);
+        }
+        // Even without a snapshot, whatever is still queued keeps going out
+        m_backend->send(m_player1);
+        m_backend->send(m_player2);
+    }
+
+    void end(sock::socket_t failed){
+        try {
+            m_pipeline.drain();
+        } catch (sock::SocketException &) {
+            // The other player failed on the last send as well, the lobby notices if they are really gone
+        }
+        const int *scores = m_arbiter ? m_arbiter->state().scores : m_state.scores;
+        submitMatch(m_results, m_names, scores[0], scores[1], m_startTime, m_tick - m_startTick);
+        int number = 1;
+        for (tcp::Connection *player : {&m_player1, &m_player2}) {
+            if (failed == *player) {
+                logging::log(logging::PlayerDisconnected, number);
+                dropPlayer(*m_backend, *player);
+            }
+            number++;
+        }
+        // Whoever is left gets the final score and goes back to the lobby
+        for (tcp::Connection *player : {&m_player1, &m_player2}) {
+            if (*player == 0) continue;
+            writeMessage(*player, GameEnd, sizeof(int) * 2, scores);
+            // The backend has to let go first, a backend sending on its own may give bytes back
+            m_backend->remove(*player);
+            std::vector<char> unsent;
+            player->takeQueued(unsent);
+            m_lobby.requeue(*player, std::move(player->inbound()), std::move(unsent));
+            *player = tcp::Connection{};
+        }
+        m_running = false;
+    }
+
+    // First instant after now on this match's phase
+    [[nodiscard]] std::chrono::steady_clock::time_point nextPhase(std::chrono::steady_clock::time_point now) const{
+        auto first = m_config.epoch + m_phase;
+        if (now < first) return first;
+        return first + ((now - first) / m_period + 1) * m_period;
+    }
+
+    const MatchConfig &m_config;
+    int m_tickRate;
+    std::chrono::nanoseconds m_period;
+    std::chrono::nanoseconds m_phase;
+    std::unique_ptr<tcp::IoBackend> m_backend;
+    rt::TimerWheel &m_wheel;
+    Lobby &m_lobby;
+    store::MatchStore &m_results;
+    tcp::Connection m_player1, m_player2;
+    Simulation::State m_state = Simulation::start();
+    std::optional<pong::RollbackArbiter> m_arbiter;
+    unsigned int m_tick = 0;
+    unsigned int m_lastInput1 = 0, m_lastInput2 = 0;
+    tcp::SnapshotPacer m_pacers[2]; // Only touched by the send stage
+    std::string m_names[2];
+    std::chrono::nanoseconds m_startTime{};
+    unsigned int m_startTick = 0;
+    bool m_running = false;
+    bool m_overran = false;
+    std::chrono::steady_clock::time_point m_deadline;
+    rt::TickPipeline<TickSnapshot> m_pipeline;
+    rt::Timer m_timer;
+};
+
+// Losing the router ends the shard, the exception comes up to main so everything, the match log included, shuts down properly
+int routerLost(const shard::ControlException &e){
+    std::cout << "Lost the router (" << e.what() << "), shutting down" << std::endl;
+    return 1;
+}
+
+void writeArenaUpdate(tcp::Connection &connection, const std::vector<EntityUpdate> &updates){
+    writeMessage(connection, ArenaUpdate, (unsigned int)(updates.size() * sizeof(EntityUpdate)), updates.data());
+}
+
+// GameStart, the pad layout and the scores, the entities follow with the client's first update
+void writeArenaStart(tcp::Connection &connection, const pong::Arena &arena){
+    GameSettings settings{Arena, 0, TPS};
+    writeMessage(connection, GameStart, sizeof(GameSettings), &settings);
+    std::vector<char> layout(sizeof(ArenaInfo));
+    ArenaInfo info{(unsigned short)arena.pads(), (unsigned short)arena.balls()};
+    std::memcpy(layout.data(), &info, sizeof(info));
+    for (double x : arena.padX()) {
+        auto padX = (float)x;
+        layout.insert(layout.end(), (const char *)&padX, (const char *)&padX + sizeof(float));
+    }
+    writeMessage(connection, ArenaLayout, layout.size(), layout.data());
+    writeMessage(connection, ScoreUpdate, sizeof(int) * 2, arena.scores());
+}
+
+// Arena mode takes over the tick loop: the match starts once every seat is taken and keeps going while anyone is left,
+// a seat that frees up mid-match goes to the next client to connect. Arena matches don't go to the match log, it only
+// knows two player games.
+void runArena(Lobby &lobby, shard::Reporter *reporter, tcp::IoBackend &backend, const rt::Profile &profile, std::chrono::milliseconds lagBudget, int playerCount, int ballCount){
+    std::vector<tcp::Connection> players(playerCount);
+    std::vector<pong::ArenaView> views(playerCount);
+    std::optional<pong::Arena> arena;
+    std::vector<EntityUpdate> updates;
+    int scores[2]{};
+    auto seated = [](const tcp::Connection &player){ return player != 0; };
+    auto drop = [&](int seat){
+        logging::log(arena ? logging::PlayerDisconnected : logging::PlayerDisconnectedLobby, seat + 1);
+        dropPlayer(backend, players[seat]);
+    };
+    std::chrono::nanoseconds tickPeriod((long long)(1. / TPS * 1000000000));
+    auto tickDeadline = std::chrono::steady_clock::now();
+    while (true){
+        lobby.run();
+        for (auto seat = players.begin(); (seat = std::find_if_not(seat, players.end(), seated)) != players.end(); seat++) {
+            if (!lobby.seat(backend, *seat, (int)(seat - players.begin()) + 1, profile.busyPoll, lagBudget)) break;
+            views[seat - players.begin()].reset();
+            if (arena) writeArenaStart(*seat, *arena);
+        }
+        if (!arena && std::all_of(players.begin(), players.end(), seated)){
+            logging::log(logging::GameStarting);
+            arena.emplace(playerCount, ballCount);
+            scores[0] = scores[1] = 0;
+            for (tcp::Connection &player : players) writeArenaStart(player, *arena);
+            for (pong::ArenaView &view : views) view.reset();
+        }
+        try {
+            backend.receive();
+        } catch (sock::SocketException &e) {
+            for (int i = 0; i < playerCount; i++)
+                if (e.socket == players[i]) drop(i);
+        }
+        Message message;
+        for (int i = 0; i < playerCount; i++) {
+            try {
+                while (seated(players[i]) && takeMessage(players[i], message)) {
+                    if (arena && message.header.type == MovePad && message.data.size() >= sizeof(int))
+                        arena->movePad(i, std::clamp(*(int *)message.data.data(), -1, 1));
                 }
+            } catch (sock::SocketException &) {
+                drop(i);
             }
         }
+        if (arena) {
+            arena->step();
+            bool scored = arena->scores()[0] != scores[0] || arena->scores()[1] != scores[1];
+            scores[0] = arena->scores()[0];
+            scores[1] = arena->scores()[1];
+            for (int i = 0; i < playerCount; i++) {
+                if (!seated(players[i])) continue;
+                // A client whose last update isn't even on the wire yet gets everything it missed with the next one
+                tcp::LinkSample link = tcp::sampleLink(players[i], backend.pending(players[i]));
+                bool busy = link.queued + link.unsent != 0;
+                if (scored) writeMessage(players[i], ScoreUpdate, sizeof(int) * 2, scores);
+                if (busy) continue;
+                updates.clear();
+                views[i].update(*arena, updates);
+                if (!updates.empty()) writeArenaUpdate(players[i], updates);
+            }
+        }
+        for (int i = 0; i < playerCount; i++) {
+            if (!seated(players[i])) continue;
+            try {
+                backend.send(players[i]);
+            } catch (sock::SocketException &) {
+                drop(i);
+            }
+        }
+        backend.submit();
+        if (arena && std::none_of(players.begin(), players.end(), seated)) arena.reset();
+        tickDeadline += tickPeriod;
+        bool overran = tickDeadline < std::chrono::steady_clock::now();
+        if (overran) tickDeadline = std::chrono::steady_clock::now();
+        if (reporter != nullptr) reporter->tick(overran, arena ? 1 : 0, std::count_if(players.begin(), players.end(), seated) + lobby.waiting(), playerCount);
+        rt::waitUntil(tickDeadline, profile.spin);
     }
 }
 
-void gameUpdateBall(sock::Socket &player1, sock::Socket &player2, const double &pad1, const double &pad2, double &ballDirection, double &ballSpeed, Position &ball, int &p1Score, int &p2Score){
-    ball.x += std::cos(ballDirection) * ballSpeed / TPS;
-    ball.y += -std::sin(ballDirection) * ballSpeed / TPS;
-    if (ball.x + BALL_SIZE / 2. < 0){
-        p2Score++;
-        ball.x = WIN_SIZEX / 2.;
-        ball.y = WIN_SIZEY / 2.;
-        ballDirection = 0;
-        int scores[2]{p1Score, p2Score};
-        broadcastMessage({player1, player2}, ScoreUpdate, sizeof(int) * 2, scores);
-        ballSpeed = BALL_DSPD;
-    }
-    if (ball.x - BALL_SIZE / 2. >= WIN_SIZEX){
-        p1Score++;
-        ball.x = WIN_SIZEX / 2.;
-        ball.y = WIN_SIZEY / 2.;
-        ballDirection = M_PI;
-        int scores[2]{p1Score, p2Score};
-        broadcastMessage({player1, player2}, ScoreUpdate, sizeof(int) * 2, scores);
-        ballSpeed = BALL_DSPD;
-    }
-    if (ball.y < 5){
-        ball.y = 5;
-        ballDirection = M_PI * 2 - ballDirection;
-        ballSpeed *= 1.1;
-        if (ballSpeed > BALL_MSPD) ballSpeed = BALL_MSPD;
-    }
-    if (ball.y > WIN_SIZEY - 5){
-        ball.y = WIN_SIZEY - 5;
-        ballDirection = M_PI * 2 - ballDirection;
-        ballSpeed *= 1.1;
-        if (ballSpeed > BALL_MSPD) ballSpeed = BALL_MSPD;
-    }
-    if (rectIntersect(ball.x - BALL_SIZE / 2., ball.y - BALL_SIZE / 2., BALL_SIZE, BALL_SIZE,
-                      PAD_OFFST - PAD_SIZEX / 2., pad1 - PAD_SIZEY / 2., PAD_SIZEX, PAD_SIZEY)){
-        ball.x = PAD_OFFST + PAD_SIZEX / 2. + BALL_SIZE / 2.;
-        double distance = (pad1 - ball.y) / PAD_SIZEY * 2.;
-        double angle = distance * M_PI_4;
-        ballDirection = angle;
-        ballSpeed *= 1.1;
-        if (ballSpeed > BALL_MSPD) ballSpeed = BALL_MSPD;
-    }
-    if (rectIntersect(ball.x - BALL_SIZE / 2., ball.y - BALL_SIZE / 2., BALL_SIZE, BALL_SIZE,
-                      WIN_SIZEX - PAD_OFFST - PAD_SIZEX / 2., pad2 - PAD_SIZEY / 2., PAD_SIZEX, PAD_SIZEY)){
-        ball.x = WIN_SIZEX - PAD_OFFST - PAD_SIZEX / 2. - BALL_SIZE / 2.;
-        double distance = (ball.y - pad2) / PAD_SIZEY * 2.;
-        double angle = distance * M_PI_4;
-        ballDirection = angle + M_PI;
-        ballSpeed *= 1.1;
-        if (ballSpeed > BALL_MSPD) ballSpeed = BALL_MSPD;
+// Times the arena's tick for growing ball counts, with the broadphase the cost per ball should stay about flat
+void arenaBench(int players){
+    std::cout << "Arena tick with " << players << " players\n";
+    for (int balls = 128; balls <= pong::Arena::maxBalls; balls *= 2) {
+        pong::Arena arena(players, balls);
+        for (int tick = 0; tick < 100; tick++) arena.step();
+        constexpr int ticks = 1000;
+        unsigned long long pairs = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int tick = 0; tick < ticks; tick++) {
+            arena.step();
+            pairs += arena.pairsTested();
+        }
+        double perTick = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() / ticks;
+        std::cout << balls << " balls: " << perTick / 1000. << "us per tick, " << perTick / balls << "ns per ball, "
+                  << pairs / ticks << " pairs tested instead of " << (unsigned long long)balls * (balls - 1) / 2 << "\n";
     }
 }
 
+// Plays a scripted match with no clients and hashes the state after every tick. Two builds that get the same hash
+// simulated the same match bit for bit, which is the point of the fixed point physics.
+template<class Sim>
+unsigned long long physicsTrace(unsigned int ticks, typename Sim::State &state){
+    state = Sim::start();
+    unsigned long long hash = 14695981039346656037ull;
+    auto mix = [&hash](const auto &value){
+        for (size_t i = 0; i < sizeof(value); i++){
+            hash ^= ((const unsigned char *)&value)[i];
+            hash *= 1099511628211ull;
+        }
+    };
+    for (unsigned int tick = 0; tick < ticks; tick++){
+        for (int player = 0; player < 2; player++){
+            // Both pads chase the ball, each one dozes off now and then so points still get scored
+            int direction = state.ballY > state.pads[player] ? 1 : -1;
+            if ((tick / 100 + player) % 3 == 0) direction = 0;
+            state.pads[player] = Sim::stepPad(state.pads[player], direction);
+        }
+        Sim::step(state);
+        mix(state.ballX);
+        mix(state.ballY);
+        mix(state.ballDirection);
+        mix(state.ballSpeed);
+        mix(state.pads);
+        mix(state.scores);
+    }
+    return hash;
+}
+
+void printPhysicsTrace(unsigned int ticks){
+    Simulation::State state;
+    unsigned long long hash = physicsTrace<Simulation>(ticks, state);
+    std::cout << ticks << " ticks of " << physicsName << " physics, score " << state.scores[0] << " - " << state.scores[1]
+              << ", state hash " << std::hex << hash << std::dec << std::endl;
+}
+
+// The fixed point trace every build has to reproduce, whichever physics the server itself runs on. A change that
+// moves the match on purpose updates the hash here.
+constexpr unsigned int physicsCheckTicks = 100000;
+constexpr unsigned long long physicsCheckHash = 0xb79cfdfaf80137b4ull;
+
+bool checkPhysicsTrace(){
+    pong::FixedSimulation::State state;
+    unsigned long long hash = physicsTrace<pong::FixedSimulation>(physicsCheckTicks, state);
+    if (hash == physicsCheckHash) {
+        std::cout << "Fixed point physics trace matches (" << std::hex << hash << std::dec << ")" << std::endl;
+        return true;
+    }
+    std::cout << "Fixed point physics trace mismatch: expected " << std::hex << physicsCheckHash << ", got " << hash << std::dec << std::endl;
+    return false;
+}
+
 int main(int argc, char **argv){
-    tcp::TcpServer server;
-    int t = 1;
-    setsockopt(server.fd(), SOL_SOCKET, SO_REUSEADDR, &t, 4);
-    setsockopt(server.fd(), IPPROTO_TCP, TCP_NODELAY, &t, 4);
-    if (argc < 2) {
-        std::cout << "Binding to localhost\n";
-        server.bind(sock::IPAddress::parse("127.0.0.1"), 25565);
+    const char *address = nullptr;
+    std::string resultsPath = "results.bin";
+    size_t leaderboard = 0;
+    const char *history = nullptr;
+    rt::Profile profile;
+    int jitterTest = 0;
+    unsigned int physicsTraceTicks = 0;
+    bool physicsTraceCheck = false;
+    const char *selfCheck = nullptr;
+    std::chrono::milliseconds lagBudget = tcp::Connection::defaultLagBudget;
+    bool useUring = false;
+    int rollbackDelay = -1;
+    int arenaPlayers = 0, arenaBalls = 0;
+    const char *shardPath = nullptr;
+    bool arenaBenchmark = false;
+    bool pipelined = false, stageTimes = false;
+    bool adaptiveSnapshots = true;
+    int matchCount = 1;
+    std::vector<int> tickRates{TPS};
+    for (int i = 1; i < argc; i++){
+        std::string arg = argv[i];
+        if (arg == "--results" && i + 1 < argc) resultsPath = argv[++i];
+        else if (arg == "--leaderboard" && i + 1 < argc) leaderboard = std::stoul(argv[++i]);
+        else if (arg == "--history" && i + 1 < argc) history = argv[++i];
+        else if (arg == "--tick-cpu" && i + 1 < argc) profile.tickCpu = std::stoi(argv[++i]);
+        else if (arg == "--io-cpu" && i + 1 < argc) profile.ioCpu = std::stoi(argv[++i]);
+        else if (arg == "--fifo" && i + 1 < argc) profile.fifoPriority = std::stoi(argv[++i]);
+        else if (arg == "--mlock") profile.lockMemory = true;
+        else if (arg == "--busy-poll" && i + 1 < argc) profile.busyPoll = std::stoi(argv[++i]);
+        else if (arg == "--spin" && i + 1 < argc) profile.spin = std::chrono::microseconds(std::stoi(argv[++i]));
+        else if (arg == "--jitter-test" && i + 1 < argc) jitterTest = std::stoi(argv[++i]);
+        else if (arg == "--physics-trace" && i + 1 < argc) physicsTraceTicks = std::stoul(argv[++i]);
+        else if (arg == "--physics-trace-check") physicsTraceCheck = true;
+        else if (arg == "--self-check" && i + 1 < argc) selfCheck = argv[++i];
+        else if (arg == "--io-uring") useUring = true;
+        else if (arg == "--pipeline") pipelined = true;
+        else if (arg == "--fixed-snapshots") adaptiveSnapshots = false;
+        else if (arg == "--matches" && i + 1 < argc) matchCount = std::max(std::stoi(argv[++i]), 1);
+        else if (arg == "--tick-rate" && i + 1 < argc) {
+            // One rate per match separated by commas, the last one goes for the rest
+            std::string list = argv[++i];
+            tickRates.clear();
+            for (size_t start = 0; start <= list.size();) {
+                size_t end = std::min(list.find(',', start), list.size());
+                tickRates.push_back(std::clamp(std::stoi(list.substr(start, end - start)), minTickRate, maxTickRate));
+                start = end + 1;
+            }
+        }
+        else if (arg == "--stage-times") stageTimes = true;
+        else if (arg == "--rollback" && i + 1 < argc) rollbackDelay = std::stoi(argv[++i]);
+        else if (arg == "--arena" && i + 1 < argc) arenaPlayers = std::clamp(std::stoi(argv[++i]), 2, pong::Arena::maxPlayers);
+        else if (arg == "--balls" && i + 1 < argc) arenaBalls = std::clamp(std::stoi(argv[++i]), 1, pong::Arena::maxBalls);
+        else if (arg == "--arena-bench") arenaBenchmark = true;
+        else if (arg == "--shard" && i + 1 < argc) shardPath = argv[++i];
+        else if (arg == "--lag-budget" && i + 1 < argc) lagBudget = std::chrono::milliseconds(std::stoi(argv[++i]));
+        else address = argv[i];
+    }
+    if (arenaBenchmark){
+        arenaBench(arenaPlayers != 0 ? arenaPlayers : pong::Arena::maxPlayers);
+        return 0;
+    }
+    if (physicsTraceCheck) return checkPhysicsTrace() ? 0 : 1;
+    if (selfCheck != nullptr) return check::run(selfCheck);
+    if (physicsTraceTicks != 0){
+        printPhysicsTrace(physicsTraceTicks);
+        return 0;
+    }
+    store::MatchStore results(resultsPath);
+    if (leaderboard != 0 || history != nullptr){
+        if (leaderboard != 0) printLeaderboard(results, leaderboard);
+        if (history != nullptr) printHistory(results, history, 20);
+        return 0;
+    }
+    applyProfile(profile, results);
+    std::chrono::nanoseconds tickPeriod((long long)(1. / TPS * 1000000000));
+    if (jitterTest != 0){
+        std::cout << "Measuring tick jitter for " << jitterTest << "s" << std::endl;
+        rt::JitterReport report = rt::measureJitter(tickPeriod, profile.spin, std::chrono::seconds(jitterTest));
+        std::cout << report.samples << " ticks, late by p50 " << report.p50.count() / 1000. << "us, p99 " << report.p99.count() / 1000.
+                  << "us, p999 " << report.p999.count() / 1000. << "us, max " << report.max.count() / 1000. << "us\n";
+        return 0;
+    }
+    printLeaderboard(results, 5);
+    tcp::TcpServer server{sock::Socket(-1)};
+    std::optional<shard::Reporter> reporter;
+    if (shardPath != nullptr) {
+        std::cout << "Joining the router at " << shardPath << "\n";
+        try {
+            server = tcp::TcpServer(shard::connectControl(shardPath));
+        } catch (sock::ConnectException &e) {
+            std::cout << "Could not reach the router (" << std::strerror(errno) << ")\n";
+            return 1;
+        }
+        reporter.emplace(server);
+        std::cout << "Shard on! ^w^" << std::endl;
     }
     else {
-        std::cout << "Binding to " << argv[1] << "\n";
-        server.bind(sock::IPAddress::parse(argv[1]), 25565);
-    }
-    std::cout << "Listening for connections\n";
-    server.listen();
-    std::cout << "Server on! ^w^\n";
-    sock::Socket player1, player2;
-    Position ball{WIN_SIZEX / 2., WIN_SIZEY / 2.};
-    double ballDirection = M_PI;
-    double ballSpeed = BALL_DSPD;
-    double pad1 = WIN_SIZEY / 2., pad2 = WIN_SIZEY / 2.;
-    int p1Score = 0, p2Score = 0;
-    double padSpeed = 350;
-    bool gameRunning = false;
-    std::chrono::nanoseconds lastTime = fetchTime();
-    while (true){
-        std::chrono::nanoseconds tickStartTime = fetchTime();
-        // Here goes logic
-        if (gameRunning){
+        server = tcp::TcpServer();
+        int t = 1;
+        setsockopt(server.fd(), SOL_SOCKET, SO_REUSEADDR, &t, 4);
+        setsockopt(server.fd(), IPPROTO_TCP, TCP_NODELAY, &t, 4);
+        if (address == nullptr) {
+            std::cout << "Binding to localhost\n";
+            server.bind(sock::IPAddress::parse("127.0.0.1"), 25565);
+        }
+        else {
+            std::cout << "Binding to " << address << "\n";
+            server.bind(sock::IPAddress::parse(address), 25565);
+        }
+        if (profile.busyPoll != 0) {
             try {
-                gamePollMessages(player1, player2, padSpeed, pad1, pad2);
-                gameUpdateBall(player1, player2, pad1, pad2, ballDirection, ballSpeed, ball, p1Score, p2Score);
-                broadcastMessage({player1, player2}, Tick, 0, nullptr);
-                broadcastMessage({player1, player2}, BallUpdate, sizeof(Position), &ball);
-            } catch (sock::SocketException &e){
-                if (e.socket == player1) {
-                    std::cout << "[SERVER] P1 disconnected\n";
-                    player1.close();
-                    player1 = {};
-                    writeMessage(player2, GameEnd, 0, nullptr);
-                }
-                if (e.socket == player2) {
-                    std::cout << "[SERVER] P2 disconnected\n";
-                    player2.close();
-                    player2 = {};
-                    writeMessage(player1, GameEnd, 0, nullptr);
-                }
-                gameRunning = false;
+                rt::busyPoll(server.fd(), profile.busyPoll);
+            } catch (rt::RealtimeException &e) {
+                std::cout << "Could not enable busy polling (" << e.what() << ")\n";
             }
-        }else{
-            lobbyPollMessages(server, player1, player2);
-            if (player1 != 0 && player2 != 0){
-                std::cout << "[SERVER] Starting game\n";
-                gameRunning = true;
-                broadcastMessage({player1, player2}, GameStart, 0, nullptr);
-                ball = {WIN_SIZEX / 2., WIN_SIZEY / 2.};
-                ballDirection = M_PI;
-                ballSpeed = BALL_DSPD;
-                pad1 = WIN_SIZEY / 2.;
-                pad2 = WIN_SIZEY / 2.;
-                p1Score = 0;
-                p2Score = 0;
-                int scores[2]{p1Score, p2Score};
-                broadcastMessage({player1, player2}, ScoreUpdate, sizeof(int) * 2, scores);
-                double pads[2]{pad1, pad2};
-                broadcastMessage({player1, player2}, PadUpdate, sizeof(double) * 2, pads);
+        }
+        std::cout << "Listening for connections\n";
+        // The lobby takes clients in bursts once per tick, a short backlog would leave the rest waiting on SYN retries
+        server.listen(SOMAXCONN);
+        std::cout << "Server on! ^w^" << std::endl;
+    }
+    shard::Reporter *shardReporter = reporter ? &*reporter : nullptr;
+    logging::logger();
+    if (useUring && pipelined) {
+        // The send stage flushes from its own thread while the tick thread receives, a ring can't be shared like that
+        std::cout << "The pipelined send stage needs the poll backend, ignoring --io-uring\n";
+        useUring = false;
+    }
+    auto makeBackend = [&useUring]() -> std::unique_ptr<tcp::IoBackend> {
+        if (useUring) {
+            try {
+                return std::make_unique<tcp::UringBackend>();
+            } catch (sock::UringException &e) {
+                std::cout << "io_uring is not available (" << e.what() << ": " << std::strerror(e.error()) << "), falling back to poll\n";
+                useUring = false;
             }
         }
-        // Here ends logic
+        return std::make_unique<tcp::PollBackend>();
+    };
+    std::unique_ptr<tcp::IoBackend> backend = makeBackend();
+    std::cout << "Using the " << backend->name() << " backend" << std::endl;
+    // Every waiting client holds an fd, take as many as the process is allowed
+    rlimit files{};
+    if (getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < files.rlim_max) {
+        files.rlim_cur = files.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &files);
+    }
+    Lobby lobby(server, shardReporter);
+    if (arenaPlayers != 0) {
+        std::cout << "Arena mode, " << arenaPlayers << " players" << std::endl;
+        try {
+            runArena(lobby, shardReporter, *backend, profile, lagBudget, arenaPlayers, arenaBalls != 0 ? arenaBalls : arenaPlayers * 4);
+        } catch (shard::ControlException &e) {
+            return routerLost(e);
+        }
+        return 0;
+    }
+    // Ticks fire at most this late and phases are spread in steps of it
+    constexpr std::chrono::microseconds wheelResolution{25};
+    auto epoch = std::chrono::steady_clock::now();
+    rt::TimerWheel wheel(wheelResolution, epoch);
+    MatchConfig config{epoch, rollbackDelay, profile.busyPoll, lagBudget, pipelined, adaptiveSnapshots};
+    // Phases spread evenly over each match's own period, the first match ticks with the lobby
+    std::vector<std::unique_ptr<Match>> matches;
+    for (int i = 0; i < matchCount; i++) {
+        int tickRate = tickRates[std::min((size_t)i, tickRates.size() - 1)];
+        std::chrono::nanoseconds period((long long)(1. / tickRate * 1000000000));
+        matches.push_back(std::make_unique<Match>(config, tickRate, period * i / matchCount, i == 0 ? std::move(backend) : makeBackend(), wheel, lobby, results));
+        if (auto thread = matches.back()->sendThread()) applyIoProfile(profile, *thread, "send stage");
+    }
+    std::cout << matchCount << (matchCount == 1 ? " match" : " matches") << " at";
+    for (size_t i = 0; i < matches.size(); i++) {
+        if (i != 0 && matches[i]->tickRate() == matches[i - 1]->tickRate()) continue;
+        std::cout << (i == 0 ? " " : ", ") << matches[i]->tickRate();
+    }
+    std::cout << " tps" << std::endl;
+    if (pipelined) std::cout << "Sending on a separate stage per match, one tick behind the simulation" << std::endl;
+    auto stageReport = std::chrono::steady_clock::now();
+    std::chrono::nanoseconds lastTime = fetchTime();
+    auto lobbyDeadline = epoch;
+    // Takes new players, starts matches and reports, at the tick rate like a match would
+    rt::Timer lobbyTimer([&]{
+        lobby.run();
+        for (auto &match : matches) {
+            if (lobby.waiting() < 2) break;
+            if (!match->running()) match->start();
+        }
         size_t tps = (size_t)std::round(1 / ((double)(fetchTime() - lastTime).count() / 1000000000.));
-        if (tps < TPS / 2) std::cout << "[SERVER] Server is running at less than half the set TPS (Running at " << tps << " tps)\n";
+        if (tps < TPS / 2) logging::log(logging::LowTps, (long long)tps);
         lastTime = fetchTime();
-        std::chrono::nanoseconds tookTime = fetchTime() - tickStartTime;
-        std::this_thread::sleep_for(std::chrono::nanoseconds ((int)(1. / TPS * 1000000000)) - tookTime);
+        if (stageTimes && std::chrono::steady_clock::now() - stageReport >= std::chrono::seconds(1)) {
+            stageReport = std::chrono::steady_clock::now();
+            rt::StageTimes times;
+            for (auto &match : matches) {
+                rt::StageTimes matchTimes = match->takeTimes();
+                times.simulate += matchTimes.simulate;
+                times.send += matchTimes.send;
+                times.stalled += matchTimes.stalled;
+                times.ticks += matchTimes.ticks;
+            }
+            if (times.ticks != 0)
+                logging::log(logging::TickStages, times.simulate.count() / times.ticks, times.send.count() / times.ticks, times.stalled.count() / times.ticks);
+        }
+        lobbyDeadline += tickPeriod;
+        bool overran = lobbyDeadline < std::chrono::steady_clock::now();
+        if (overran) lobbyDeadline = std::chrono::steady_clock::now();
+        unsigned int running = 0;
+        for (auto &match : matches) {
+            overran |= match->takeOverran();
+            running += match->running();
+        }
+        if (reporter) reporter->tick(overran, running, running * 2 + lobby.waiting(), matches.size() * 2);
+        wheel.schedule(lobbyTimer, lobbyDeadline);
+    });
+    wheel.schedule(lobbyTimer, epoch);
+    try {
+        while (true){
+            rt::waitUntil(*wheel.nextDeadline(), profile.spin);
+            wheel.advance(std::chrono::steady_clock::now());
+        }
+    } catch (shard::ControlException &e) {
+        return routerLost(e);
     }
-}
\ No newline at end of file
+}